@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Generates SysY benchmark programs at a configurable scale.
+
+usage: gen.py <shape> <n> [seed]
+
+shapes:
+  deep    one return expression nested n levels deep
+  stmts   n assignment statements over a handful of variables
+  decls   n const and int declarations, each using earlier ones
+  logic   statements whose right-hand sides are && / || chains with
+          n operands in total
+"""
+import random
+import sys
+
+VARS = ["x", "y", "z", "w"]
+ARITH = ["+", "-", "*", "/", "%"]
+REL = ["<", ">", "<=", ">=", "==", "!="]
+
+
+def leaf(r):
+    if r.random() < 0.5:
+        return r.choice(VARS)
+    return str(r.randint(1, 100))
+
+
+def expr(r, depth):
+    if depth <= 0:
+        return leaf(r)
+    op = r.choice(ARITH + REL)
+    if op in ("/", "%"):
+        # keep the right operand a non-zero constant
+        return "(%s %s %d)" % (expr(r, depth - 1), op, r.randint(1, 9))
+    return "(%s %s %s)" % (expr(r, depth - 1), op, expr(r, depth - 1))
+
+
+def deep(r, n):
+    # right-nested so the parser and every recursive AST walk go n deep
+    ops = ARITH + REL + ["&&", "||"]
+    text = leaf(r)
+    for _ in range(n):
+        op = r.choice(ops)
+        if op in ("/", "%"):
+            text = "(%s %s %d)" % (text, op, r.randint(1, 9))
+        else:
+            text = "(%s %s %s)" % (leaf(r), op, text)
+    yield "  return %s;" % text
+
+
+def stmts(r, n):
+    for _ in range(n):
+        yield "  %s = %s;" % (r.choice(VARS), expr(r, 3))
+    yield "  return x + y + z + w;"
+
+
+def decls(r, n):
+    consts, ints = ["C0"], ["v0"]
+    yield "  const int C0 = 1;"
+    yield "  int v0 = 2;"
+    i = 1
+    while i < n:
+        if r.random() < 0.5:
+            defs = []
+            for _ in range(r.randint(1, 4)):
+                defs.append("C%d = %s %s %d" % (i, r.choice(consts[-16:]), r.choice("+-*"), r.randint(1, 9)))
+                consts.append("C%d" % i)
+                i += 1
+            yield "  const int %s;" % ", ".join(defs)
+        else:
+            defs = []
+            for _ in range(r.randint(1, 4)):
+                defs.append("v%d = %s + %s" % (i, r.choice(ints[-16:]), r.choice(consts[-16:])))
+                ints.append("v%d" % i)
+                i += 1
+            yield "  int %s;" % ", ".join(defs)
+    yield "  return %s + %s;" % (ints[-1], consts[-1])
+
+
+def logic(r, n):
+    chain = 64
+    while n > 0:
+        k = min(chain, n)
+        n -= k
+        ops = [leaf(r) if r.random() < 0.5 else "%s %s %s" % (leaf(r), r.choice(REL), leaf(r))
+               for _ in range(k)]
+        text = ops[0]
+        for op in ops[1:]:
+            text += " %s %s" % (r.choice(["&&", "||"]), op)
+        yield "  %s = %s;" % (r.choice(VARS), text)
+    yield "  return x + y + z + w;"
+
+
+SHAPES = {"deep": deep, "stmts": stmts, "decls": decls, "logic": logic}
+
+
+def main():
+    if len(sys.argv) < 3 or sys.argv[1] not in SHAPES:
+        sys.exit(__doc__)
+    shape, n = sys.argv[1], int(sys.argv[2])
+    r = random.Random(int(sys.argv[3]) if len(sys.argv) > 3 else n)
+    out = ["int main() {", "  int x = 1, y = 2, z = 3, w = 4;"]
+    out.extend(SHAPES[shape](r, n))
+    out.append("}")
+    sys.stdout.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
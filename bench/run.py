@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Runs the compiler over generated benchmark inputs and records wall time
+and peak RSS per input and mode.
+
+usage: run.py <compiler> <work dir> [scale]
+
+Each shape is generated at three sizes, each double the previous one, so
+that the growth column shows how time scales: about 2.0 is linear, and
+anything well above it points at superlinear behavior. Peak RSS is the
+child's ru_maxrss, which never reads below the interpreter that forks it.
+"""
+import os
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# base size per shape at scale 1; deep is bounded by the parser stack
+SHAPES = [("deep", 500), ("stmts", 5000), ("decls", 5000), ("logic", 20000)]
+MODES = [["-koopa"], ["-riscv"], ["-riscv", "-O1"]]
+
+
+def measure(cmd):
+    start = time.perf_counter()
+    proc = subprocess.Popen(cmd)
+    _, status, usage = os.wait4(proc.pid, 0)
+    elapsed = time.perf_counter() - start
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    return proc.returncode, elapsed, usage.ru_maxrss
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    compiler, work = sys.argv[1], sys.argv[2]
+    scale = float(sys.argv[3]) if len(sys.argv) > 3 else 1.0
+    os.makedirs(work, exist_ok=True)
+
+    rows = []
+    failed = False
+    print("%-8s %8s %-10s %10s %8s %10s" % ("shape", "n", "mode", "time ms", "growth", "RSS KB"))
+    for shape, base in SHAPES:
+        prev = {}
+        for step in range(3):
+            n = int(base * scale) << step
+            src = os.path.join(work, "%s_%d.c" % (shape, n))
+            with open(src, "w") as f:
+                subprocess.run([sys.executable, os.path.join(HERE, "gen.py"), shape, str(n)],
+                               stdout=f, check=True)
+            for mode in MODES:
+                name = "".join(mode)
+                out = os.path.join(work, "%s_%d%s.out" % (shape, n, name))
+                rc, elapsed, rss = measure([compiler, mode[0], src, "-o", out] + mode[1:])
+                growth = "%.2f" % (elapsed / prev[name]) if name in prev else "-"
+                prev[name] = elapsed
+                if rc != 0:
+                    failed = True
+                    growth = "rc=%d" % rc
+                print("%-8s %8d %-10s %10.1f %8s %10d" % (shape, n, name, elapsed * 1000, growth, rss))
+                rows.append("%s,%d,%s,%d,%.3f,%d" % (shape, n, name, rc, elapsed * 1000, rss))
+
+    with open(os.path.join(work, "results.csv"), "w") as f:
+        f.write("shape,n,mode,rc,time_ms,max_rss_kb\n")
+        f.write("\n".join(rows) + "\n")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
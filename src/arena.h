@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Bump allocator owning every AST node and identifier of one compilation.
+// Nodes are laid out back to back in the order the parser reduces them,
+// and everything is released at once when the arena is destroyed. Only
+// trivially destructible objects may live here, so no destructor ever
+// has to run.
+class Arena
+{
+public:
+    static const size_t block_size = 64 * 1024;
+
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        static_assert(is_trivially_destructible<T>::value,
+                      "arena objects are never destroyed");
+        ++objects;
+        return new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    }
+
+    // Uninitialized storage for n objects of a trivially copyable type.
+    template <typename T>
+    T *make_array(size_t n)
+    {
+        static_assert(is_trivially_copyable<T>::value,
+                      "arena arrays are copied bytewise");
+        return static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // Copies len bytes of s into the arena as a NUL-terminated string.
+    const char *make_string(const char *s, size_t len)
+    {
+        char *p = static_cast<char *>(allocate(len + 1, 1));
+        memcpy(p, s, len);
+        p[len] = '\0';
+        return p;
+    }
+
+    size_t bytes_used() const
+    {
+        return used;
+    }
+
+    // Number of objects created by make(), i.e. AST nodes.
+    size_t object_count() const
+    {
+        return objects;
+    }
+
+private:
+    vector<unique_ptr<char[]>> blocks;
+    char *cur = nullptr;
+    char *end = nullptr;
+    size_t used = 0;
+    size_t objects = 0;
+
+    void *allocate(size_t size, size_t align)
+    {
+        size_t pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+        if (cur == nullptr || pad + size > static_cast<size_t>(end - cur))
+        {
+            size_t n = size + align > block_size ? size + align : block_size;
+            blocks.emplace_back(new char[n]);
+            cur = blocks.back().get();
+            end = cur + n;
+            pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+        }
+        void *p = cur + pad;
+        cur += pad + size;
+        used += size;
+        return p;
+    }
+};
+
+// Growable array whose storage lives in an Arena, for list nodes built by
+// the parser. Growing copies into a fresh region and abandons the old one,
+// so the space wasted is bounded by the final capacity.
+template <typename T>
+class ArenaVector
+{
+public:
+    void push_back(Arena &arena, const T &x)
+    {
+        if (len == cap)
+        {
+            size_t new_cap = cap == 0 ? 4 : cap * 2;
+            T *new_items = arena.make_array<T>(new_cap);
+            if (len != 0)
+                memcpy(new_items, items, len * sizeof(T));
+            items = new_items;
+            cap = new_cap;
+        }
+        items[len++] = x;
+    }
+
+    T *begin() const
+    {
+        return items;
+    }
+
+    T *end() const
+    {
+        return items + len;
+    }
+
+    size_t size() const
+    {
+        return len;
+    }
+
+    T &operator[](size_t i) const
+    {
+        return items[i];
+    }
+
+private:
+    T *items = nullptr;
+    size_t len = 0;
+    size_t cap = 0;
+};
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "asm_writer.h"
+
+using namespace std;
+
+// RISC-V integer registers, numbered as in the encoding (x0-x31).
+enum class Reg : int8_t
+{
+    none = -1,
+    zero, ra, sp, gp, tp, t0, t1, t2,
+    s0, s1, a0, a1, a2, a3, a4, a5,
+    a6, a7, s2, s3, s4, s5, s6, s7,
+    s8, s9, s10, s11, t3, t4, t5, t6
+};
+
+static const char *reg_name[] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+// t0-t3 hold immediates, spilled operands and spilled results for the
+// duration of a single IR instruction and are never live across blocks.
+static bool is_scratch(Reg r)
+{
+    return r == Reg::t0 || r == Reg::t1 || r == Reg::t2 || r == Reg::t3;
+}
+
+enum class AsmOp : uint8_t
+{
+    // rd, rs1, rs2
+    ADD, SUB, MUL, MULH, DIV, REM, AND, OR, XOR, SLL, SRL, SRA, SLT, SGT,
+    // rd, rs1, imm
+    ADDI, ANDI, ORI, XORI, SLTI, SLLI, SRLI, SRAI,
+    // rd, rs1
+    MV, SEQZ, SNEZ,
+    // rd, imm
+    LI,
+    // rd, imm(rs1)
+    LW,
+    // rs2, imm(rs1)
+    SW,
+    // rs1, label imm
+    BNEZ, BEQZ,
+    // label imm
+    J,
+    RET,
+    // label imm:
+    LABEL,
+    // deleted by the peephole pass, never printed
+    NOP
+};
+
+static const char *asm_op_name[] = {
+    "add", "sub", "mul", "mulh", "div", "rem", "and", "or", "xor", "sll", "srl", "sra", "slt", "sgt",
+    "addi", "andi", "ori", "xori", "slti", "slli", "srli", "srai",
+    "mv", "seqz", "snez",
+    "li",
+    "lw",
+    "sw",
+    "bnez", "beqz",
+    "j",
+    "ret",
+    "",
+    "nop"};
+
+struct AsmInst
+{
+    AsmOp op;
+    Reg rd;
+    Reg rs1;
+    Reg rs2;
+    int imm; // immediate, memory offset or label id
+
+    bool is_rrr() const
+    {
+        return op <= AsmOp::SGT;
+    }
+
+    bool is_rri() const
+    {
+        return op >= AsmOp::ADDI && op <= AsmOp::SRAI;
+    }
+
+    bool is_rr() const
+    {
+        return op >= AsmOp::MV && op <= AsmOp::SNEZ;
+    }
+
+    // Control leaves the straight-line sequence at this instruction.
+    bool ends_sequence() const
+    {
+        return op == AsmOp::BNEZ || op == AsmOp::BEQZ || op == AsmOp::J || op == AsmOp::RET || op == AsmOp::LABEL;
+    }
+
+    // Register written by this instruction, or Reg::none.
+    Reg def() const
+    {
+        if (op >= AsmOp::SW)
+            return Reg::none;
+        return rd;
+    }
+
+    bool reads(Reg r) const
+    {
+        if (r == Reg::none)
+            return false;
+        if (op == AsmOp::RET)
+            return r == Reg::a0 || r == Reg::sp || r == Reg::ra;
+        return rs1 == r || rs2 == r;
+    }
+};
+
+static AsmInst make_inst(AsmOp op, Reg rd = Reg::none, Reg rs1 = Reg::none, Reg rs2 = Reg::none, int imm = 0)
+{
+    return AsmInst{op, rd, rs1, rs2, imm};
+}
+
+// Code of one function. Labels are numbered per function; label_names[id]
+// is the name of the block, or of the branch edge, they were created for.
+struct AsmFunction
+{
+    const char *name;
+    vector<AsmInst> code;
+    vector<string> label_names;
+
+    void emit(AsmOp op, Reg rd = Reg::none, Reg rs1 = Reg::none, Reg rs2 = Reg::none, int imm = 0)
+    {
+        code.push_back(make_inst(op, rd, rs1, rs2, imm));
+    }
+
+    AsmWriter &print_label(AsmWriter &out, int id) const
+    {
+        return out << ".L" << name << "_" << label_names[id];
+    }
+
+    void print(AsmWriter &out) const
+    {
+        out << name << ":\n";
+        for (const auto &inst : code)
+        {
+            if (inst.op == AsmOp::NOP)
+                continue;
+            if (inst.op == AsmOp::LABEL)
+            {
+                print_label(out, inst.imm) << ":\n";
+                continue;
+            }
+            out << asm_op_name[static_cast<int>(inst.op)];
+            if (inst.is_rrr())
+                out << " " << reg_name[(int)inst.rd] << ", " << reg_name[(int)inst.rs1] << ", " << reg_name[(int)inst.rs2];
+            else if (inst.is_rri())
+                out << " " << reg_name[(int)inst.rd] << ", " << reg_name[(int)inst.rs1] << ", " << inst.imm;
+            else if (inst.is_rr())
+                out << " " << reg_name[(int)inst.rd] << ", " << reg_name[(int)inst.rs1];
+            else if (inst.op == AsmOp::LI)
+                out << " " << reg_name[(int)inst.rd] << ", " << inst.imm;
+            else if (inst.op == AsmOp::LW)
+                out << " " << reg_name[(int)inst.rd] << ", " << inst.imm << "(" << reg_name[(int)inst.rs1] << ")";
+            else if (inst.op == AsmOp::SW)
+                out << " " << reg_name[(int)inst.rs2] << ", " << inst.imm << "(" << reg_name[(int)inst.rs1] << ")";
+            else if (inst.op == AsmOp::BNEZ || inst.op == AsmOp::BEQZ)
+                print_label(out << " " << reg_name[(int)inst.rs1] << ", ", inst.imm);
+            else if (inst.op == AsmOp::J)
+                print_label(out << " ", inst.imm);
+            out << "\n";
+        }
+    }
+
+    // Appends the RV32IM machine code, expanding pseudo-instructions the
+    // way an assembler does. A conditional branch that cannot reach its
+    // label within 4 KiB becomes the inverse branch over a jump, and a jump
+    // that cannot reach within 1 MiB, on its own or in such a branch,
+    // becomes auipc and jalr through t1. Sizes only grow, so the loop
+    // settles every one before anything is written.
+    void encode(AsmWriter &out) const
+    {
+        vector<int> label_at(label_names.size(), 0);
+        vector<uint8_t> reach(code.size(), NEAR);
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            int pc = 0;
+            for (size_t i = 0; i < code.size(); ++i)
+            {
+                if (code[i].op == AsmOp::LABEL)
+                    label_at[code[i].imm] = pc;
+                pc += encoded_size(code[i], reach[i]);
+            }
+            pc = 0;
+            for (size_t i = 0; i < code.size(); ++i)
+            {
+                bool branch = code[i].op == AsmOp::BNEZ || code[i].op == AsmOp::BEQZ;
+                if (branch || code[i].op == AsmOp::J)
+                {
+                    int dist = label_at[code[i].imm] - pc;
+                    uint8_t need = FAR;
+                    if (branch && fits(dist, 13))
+                        need = NEAR;
+                    else if (fits(dist - 4 * branch, 21))
+                        need = branch ? JAL : NEAR;
+                    if (need > reach[i])
+                    {
+                        reach[i] = need;
+                        changed = true;
+                    }
+                }
+                pc += encoded_size(code[i], reach[i]);
+            }
+        }
+
+        int pc = 0;
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            const auto &inst = code[i];
+            int rd = static_cast<int>(inst.rd), rs1 = static_cast<int>(inst.rs1), rs2 = static_cast<int>(inst.rs2);
+            switch (inst.op)
+            {
+            case AsmOp::ADD:
+            case AsmOp::SUB:
+            case AsmOp::MUL:
+            case AsmOp::MULH:
+            case AsmOp::DIV:
+            case AsmOp::REM:
+            case AsmOp::AND:
+            case AsmOp::OR:
+            case AsmOp::XOR:
+            case AsmOp::SLL:
+            case AsmOp::SRL:
+            case AsmOp::SRA:
+            case AsmOp::SLT:
+                out.put_word(r_type(inst.op, rd, rs1, rs2));
+                break;
+            case AsmOp::SGT:
+                out.put_word(r_type(AsmOp::SLT, rd, rs2, rs1));
+                break;
+            case AsmOp::ADDI:
+            case AsmOp::ANDI:
+            case AsmOp::ORI:
+            case AsmOp::XORI:
+            case AsmOp::SLTI:
+            case AsmOp::SLLI:
+            case AsmOp::SRLI:
+            case AsmOp::SRAI:
+                out.put_word(i_type(inst.op, rd, rs1, inst.imm));
+                break;
+            case AsmOp::MV:
+                out.put_word(i_type(AsmOp::ADDI, rd, rs1, 0));
+                break;
+            case AsmOp::SEQZ:
+                out.put_word(i_type(0x13, 3, rd, rs1, 1)); // sltiu rd, rs1, 1
+                break;
+            case AsmOp::SNEZ:
+                out.put_word(0x33 | rd << 7 | 3 << 12 | rs1 << 20); // sltu rd, zero, rs1
+                break;
+            case AsmOp::LI:
+            {
+                uint32_t hi;
+                int lo;
+                split_imm(inst.imm, hi, lo);
+                if (hi == 0)
+                    out.put_word(i_type(AsmOp::ADDI, rd, 0, lo));
+                else
+                {
+                    out.put_word(0x37 | rd << 7 | hi << 12); // lui
+                    if (lo != 0)
+                        out.put_word(i_type(AsmOp::ADDI, rd, rd, lo));
+                }
+                break;
+            }
+            case AsmOp::LW:
+                out.put_word(i_type(0x03, 2, rd, rs1, inst.imm));
+                break;
+            case AsmOp::SW:
+                out.put_word(0x23 | (inst.imm & 0x1f) << 7 | 2 << 12 | rs1 << 15 | rs2 << 20 |
+                             static_cast<uint32_t>(inst.imm >> 5 & 0x7f) << 25);
+                break;
+            case AsmOp::BNEZ:
+            case AsmOp::BEQZ:
+            {
+                int funct3 = inst.op == AsmOp::BNEZ ? 1 : 0;
+                if (reach[i] == NEAR)
+                    out.put_word(b_type(funct3, rs1, label_at[inst.imm] - pc));
+                else
+                {
+                    out.put_word(b_type(funct3 ^ 1, rs1, encoded_size(inst, reach[i])));
+                    put_jump(out, reach[i], label_at[inst.imm] - pc - 4);
+                }
+                break;
+            }
+            case AsmOp::J:
+                put_jump(out, reach[i], label_at[inst.imm] - pc);
+                break;
+            case AsmOp::RET:
+                out.put_word(0x67 | static_cast<int>(Reg::ra) << 15); // jalr zero, 0(ra)
+                break;
+            default:
+                break;
+            }
+            pc += encoded_size(inst, reach[i]);
+        }
+    }
+
+private:
+    // How a branch or jump reaches its label: directly (a jump is a jal),
+    // through a jal after the inverse branch, or through auipc and jalr.
+    enum Reach : uint8_t
+    {
+        NEAR,
+        JAL,
+        FAR
+    };
+
+    // Whether x fits a signed immediate of the given bits.
+    static bool fits(int x, int bits)
+    {
+        return x >= -(1 << (bits - 1)) && x < (1 << (bits - 1));
+    }
+
+    // Splits x into the upper 20 bits that lui or auipc sets and the low 12
+    // bits, sign-extended, that addi or jalr adds back. The arithmetic is
+    // unsigned, as hi << 12 and x - (hi << 12) can overflow an int.
+    static void split_imm(int x, uint32_t &hi, int &lo)
+    {
+        uint32_t u = static_cast<uint32_t>(x);
+        hi = (u + 0x800) >> 12;
+        lo = static_cast<int>((u & 0xfff) ^ 0x800) - 0x800;
+    }
+
+    static int encoded_size(const AsmInst &inst, uint8_t reach)
+    {
+        switch (inst.op)
+        {
+        case AsmOp::LABEL:
+        case AsmOp::NOP:
+            return 0;
+        case AsmOp::LI:
+            return inst.imm >= -2048 && inst.imm <= 2047 ? 4 : (inst.imm & 0xfff) == 0 ? 4 : 8;
+        case AsmOp::BNEZ:
+        case AsmOp::BEQZ:
+            return 4 + reach * 4;
+        case AsmOp::J:
+            return reach == FAR ? 8 : 4;
+        default:
+            return 4;
+        }
+    }
+
+    static uint32_t r_type(AsmOp op, int rd, int rs1, int rs2)
+    {
+        // funct7 << 3 | funct3, indexed like the rrr group of AsmOp
+        static const uint32_t funct[] = {0x000, 0x100, 0x008, 0x009, 0x00c, 0x00e, 0x007,
+                                         0x006, 0x004, 0x001, 0x005, 0x105, 0x002};
+        uint32_t f = funct[static_cast<int>(op)];
+        return 0x33 | rd << 7 | (f & 7) << 12 | rs1 << 15 | rs2 << 20 | (f >> 3) << 25;
+    }
+
+    static uint32_t i_type(uint32_t opcode, int funct3, int rd, int rs1, int imm)
+    {
+        return opcode | rd << 7 | funct3 << 12 | rs1 << 15 | static_cast<uint32_t>(imm) << 20;
+    }
+
+    static uint32_t i_type(AsmOp op, int rd, int rs1, int imm)
+    {
+        switch (op)
+        {
+        case AsmOp::ANDI:
+            return i_type(0x13, 7, rd, rs1, imm);
+        case AsmOp::ORI:
+            return i_type(0x13, 6, rd, rs1, imm);
+        case AsmOp::XORI:
+            return i_type(0x13, 4, rd, rs1, imm);
+        case AsmOp::SLTI:
+            return i_type(0x13, 2, rd, rs1, imm);
+        case AsmOp::SLLI:
+            return i_type(0x13, 1, rd, rs1, imm & 31);
+        case AsmOp::SRLI:
+            return i_type(0x13, 5, rd, rs1, imm & 31);
+        case AsmOp::SRAI:
+            return i_type(0x13, 5, rd, rs1, (imm & 31) | 0x400);
+        default:
+            return i_type(0x13, 0, rd, rs1, imm);
+        }
+    }
+
+    static void put_jump(AsmWriter &out, uint8_t reach, int offset)
+    {
+        if (reach != FAR)
+        {
+            out.put_word(j_type(offset));
+            return;
+        }
+        int t1 = static_cast<int>(Reg::t1);
+        uint32_t hi;
+        int lo;
+        split_imm(offset, hi, lo);
+        out.put_word(0x17 | t1 << 7 | hi << 12); // auipc t1, hi
+        out.put_word(i_type(0x67, 0, 0, t1, lo)); // jalr zero, lo(t1)
+    }
+
+    static uint32_t b_type(int funct3, int rs1, int offset)
+    {
+        assert(fits(offset, 13));
+        uint32_t x = static_cast<uint32_t>(offset);
+        return 0x63 | (x >> 11 & 1) << 7 | (x >> 1 & 0xf) << 8 | funct3 << 12 | rs1 << 15 | (x >> 5 & 0x3f) << 25 |
+               (x >> 12 & 1) << 31;
+    }
+
+    static uint32_t j_type(int offset)
+    {
+        assert(fits(offset, 21));
+        uint32_t x = static_cast<uint32_t>(offset);
+        return 0x6f | (x >> 12 & 0xff) << 12 | (x >> 11 & 1) << 20 | (x >> 1 & 0x3ff) << 21 | (x >> 20 & 1) << 31;
+    }
+};
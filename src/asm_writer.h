@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using namespace std;
+
+// Collects the generated assembly in one large buffer. Integers are
+// formatted in place, and the text reaches the output file in a single
+// write when flush() is called at the end of code generation.
+class AsmWriter
+{
+public:
+    AsmWriter()
+    {
+        buf.reserve(1 << 20);
+    }
+
+    AsmWriter &operator<<(const char *s)
+    {
+        buf.append(s);
+        return *this;
+    }
+
+    AsmWriter &operator<<(const string &s)
+    {
+        buf.append(s);
+        return *this;
+    }
+
+    AsmWriter &operator<<(int x)
+    {
+        char tmp[16];
+        auto res = to_chars(tmp, tmp + sizeof(tmp), x);
+        buf.append(tmp, res.ptr);
+        return *this;
+    }
+
+    // Appends a 32-bit word in little-endian order, for machine code.
+    void put_word(uint32_t word)
+    {
+        char bytes[4] = {char(word), char(word >> 8), char(word >> 16), char(word >> 24)};
+        buf.append(bytes, 4);
+    }
+
+    size_t size() const
+    {
+        return buf.size();
+    }
+
+    void flush(FILE *file)
+    {
+        lines += count(buf.begin(), buf.end(), '\n');
+        fwrite(buf.data(), 1, buf.size(), file);
+        fflush(file);
+        buf.clear();
+    }
+
+    // Hands over the text collected so far and starts an empty buffer.
+    string take()
+    {
+        string text;
+        text.swap(buf);
+        return text;
+    }
+
+    // Lines written by flush() so far.
+    size_t line_count() const
+    {
+        return lines;
+    }
+
+private:
+    string buf;
+    size_t lines = 0;
+};
@@ -2,215 +2,323 @@
 
 #include <iostream>
 #include <memory>
+#include <string>
+#include <string_view>
 #include <cassert>
-#include <tr1/unordered_map>
+#include "arena.h"
+#include "ir.h"
+#include "symtab.h"
 using namespace std;
 
-static int func_cnt = 0;
-static int val_cnt = 0;
-
-static tr1::unordered_map<string, int> consts;
-static tr1::unordered_map<string, string> vars;
+// Emits op, or folds it into an immediate when both operands are known.
+static Operand gen_binary(IRBuilder &ir, koopa_raw_binary_op_t op, Operand lhs, Operand rhs)
+{
+    int result;
+    if (lhs.imm && rhs.imm && eval_binary(op, lhs.value, rhs.value, result))
+        return Operand::integer(result);
+    return ir.binary(op, lhs, rhs);
+}
 
 class BaseAST
 {
 public:
-    virtual ~BaseAST() = default;
-
-    virtual string IR_string(shared_ptr<string> id) const
+    virtual Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const
     {
-        return "";
+        return Operand::integer(0);
     }
 
-    virtual int get_value() const
+    virtual int get_value(const SymbolTable &symtab) const
     {
         return 0;
     }
 
-    virtual string get_ident() const
+    virtual string_view get_ident() const
     {
         return "";
     }
+
+    virtual int get_symbol() const
+    {
+        return -1;
+    }
+
+    // Whether control never passes to the next block item.
+    virtual bool returns() const
+    {
+        return false;
+    }
+
+    // Rough number of instructions gen_IR emits for an expression. Besides
+    // division, none of the expressions have side effects, so a cheap one
+    // may be evaluated even when its value turns out not to be needed.
+    virtual int cost(const SymbolTable &symtab) const
+    {
+        return 0;
+    }
 };
 
+// Right-hand sides of && and || up to this cost are evaluated without a
+// branch: ne, ne, and/or is cheaper than the blocks around a tiny operand.
+static const int cheap_rhs_cost = 2;
+
+// Cost of a division or modulo, which traps on a zero divisor and so must
+// only run when the program would have run it.
+static const int trap_cost = cheap_rhs_cost + 1;
+
+// Lowers x && rhs (op is and) or x || rhs (op is or). Unless rhs is cheap,
+// it is only evaluated when x does not decide the result; the result is
+// then merged through a stack slot.
+static Operand gen_logic(IRBuilder &ir, SymbolTable &symtab, koopa_raw_binary_op_t op, Operand x, const BaseAST *rhs)
+{
+    bool is_and = op == KOOPA_RBO_AND;
+    Operand zero = Operand::integer(0);
+    if (x.imm)
+    {
+        if ((x.value != 0) != is_and)
+            return Operand::integer(is_and ? 0 : 1);
+        return gen_binary(ir, KOOPA_RBO_NOT_EQ, rhs->gen_IR(ir, symtab), zero);
+    }
+
+    if (rhs->cost(symtab) <= cheap_rhs_cost)
+    {
+        Operand x_bool = gen_binary(ir, KOOPA_RBO_NOT_EQ, x, zero);
+        Operand y_bool = gen_binary(ir, KOOPA_RBO_NOT_EQ, rhs->gen_IR(ir, symtab), zero);
+        if (y_bool.imm)
+            return (y_bool.value != 0) == is_and ? x_bool : y_bool;
+        return gen_binary(ir, op, x_bool, y_bool);
+    }
+
+    Operand result = ir.alloc();
+    ir.store(Operand::integer(is_and ? 0 : 1), result);
+    Block rhs_bb = ir.new_block(is_and ? "land_rhs" : "lor_rhs");
+    Block end_bb = ir.new_block(is_and ? "land_end" : "lor_end");
+    if (is_and)
+        ir.br(x, rhs_bb, end_bb);
+    else
+        ir.br(x, end_bb, rhs_bb);
+
+    ir.set_block(rhs_bb);
+    ir.store(gen_binary(ir, KOOPA_RBO_NOT_EQ, rhs->gen_IR(ir, symtab), zero), result);
+    ir.jump(end_bb);
+
+    ir.set_block(end_bb);
+    return ir.load(result);
+}
+
 class CompUnitAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> func_def;
+    BaseAST *func_def;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return func_def->IR_string(nullptr);
+        return func_def->gen_IR(ir, symtab);
     }
 };
 
 class FuncDefAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> func_type;
-    string ident;
-    unique_ptr<BaseAST> block;
+    BaseAST *func_type;
+    string_view ident;
+    BaseAST *block;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return "fun @" + ident + "(): " + func_type->IR_string(nullptr) + "\n{\n" + block->IR_string(nullptr) + "}\n";
+        assert(func_type->get_ident() == "int");
+        ir.func_begin(string(ident));
+        block->gen_IR(ir, symtab);
+        ir.func_end();
+        return Operand::integer(0);
     }
 };
 
 class FuncTypeAST : public BaseAST
 {
 public:
-    string _int;
+    string_view _int;
 
-    string IR_string(shared_ptr<string> id) const override
+    string_view get_ident() const override
     {
-        assert(_int.compare(string("int")) == 0);
-        return "i32";
+        return _int;
     }
 };
 
 class BlockAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> block_items;
+    BaseAST *block_items;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return "\%entry:\n" + block_items->IR_string(nullptr);
+        ir.set_block(ir.new_block("entry"));
+        symtab.push_scope();
+        block_items->gen_IR(ir, symtab);
+        symtab.pop_scope();
+        return Operand::integer(0);
     }
 };
 
 class BlockItemsAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> block_items;
-    unique_ptr<BaseAST> block_item;
+    ArenaVector<BaseAST *> block_items;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        string s;
-        if (block_items != nullptr)
-            s += block_items->IR_string(nullptr);
-        s += block_item->IR_string(nullptr);
-        return s;
+        // items after a return are unreachable and not lowered
+        for (auto block_item : block_items)
+        {
+            block_item->gen_IR(ir, symtab);
+            if (block_item->returns())
+                break;
+        }
+        return Operand::integer(0);
     }
 };
 
 class BlockItemAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> decl;
+    BaseAST *decl;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return decl->IR_string(nullptr);
+        return decl->gen_IR(ir, symtab);
     }
 };
 
 class BlockItemAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> stmt;
+    BaseAST *stmt;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return stmt->IR_string(nullptr);
+        return stmt->gen_IR(ir, symtab);
+    }
+
+    bool returns() const override
+    {
+        return stmt->returns();
     }
 };
 
 class StmtAST_0 : public BaseAST
 {
 public:
-    string _return;
-    unique_ptr<BaseAST> exp;
+    string_view _return;
+    BaseAST *exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
         assert(_return.compare(string("return")) == 0);
-        auto exp_id = make_shared<string>();
-        string s = exp->IR_string(exp_id);
-        return s + "ret " + *exp_id + "\n";
+        ir.ret(exp->gen_IR(ir, symtab));
+        return Operand::integer(0);
+    }
+
+    bool returns() const override
+    {
+        return true;
     }
 };
 
 class StmtAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> lval;
-    unique_ptr<BaseAST> exp;
+    BaseAST *lval;
+    BaseAST *exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto lval_id = make_shared<string>();
-        auto exp_id = make_shared<string>();
-        assert(vars.count(lval->get_ident()) != 0);
-        string s = exp->IR_string(exp_id);
-        return s + "store " + *exp_id + ", " + vars[lval->get_ident()] + "\n";
+        const Symbol *symbol = symtab.lookup(lval->get_symbol());
+        assert(symbol != nullptr && !symbol->is_const);
+        ir.store(exp->gen_IR(ir, symtab), symbol->var);
+        return Operand::integer(0);
     }
 };
 
 class ExpAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> lor_exp;
+    BaseAST *lor_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return lor_exp->IR_string(id);
+        return lor_exp->gen_IR(ir, symtab);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return lor_exp->get_value();
+        return lor_exp->get_value(symtab);
+    }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return lor_exp->cost(symtab);
     }
 };
 
 class PrimaryExpAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> exp;
+    BaseAST *exp;
+
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
+    {
+        return exp->gen_IR(ir, symtab);
+    }
 
-    string IR_string(shared_ptr<string> id) const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return exp->IR_string(id);
+        return exp->get_value(symtab);
     }
 
-    int get_value() const override
+    int cost(const SymbolTable &symtab) const override
     {
-        return exp->get_value();
+        return exp->cost(symtab);
     }
 };
 
 class PrimaryExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> number;
+    BaseAST *number;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        *id = number->IR_string(nullptr);
-        return "";
+        return number->gen_IR(ir, symtab);
+    }
+
+    int get_value(const SymbolTable &symtab) const override
+    {
+        return number->get_value(symtab);
     }
 
-    int get_value() const override
+    int cost(const SymbolTable &symtab) const override
     {
-        return number->get_value();
+        return number->cost(symtab);
     }
 };
 
 class PrimaryExpAST_2 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> lval;
+    BaseAST *lval;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return lval->IR_string(id);
+        return lval->gen_IR(ir, symtab);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return lval->get_value();
+        return lval->get_value(symtab);
+    }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return lval->cost(symtab);
     }
 };
 
@@ -219,12 +327,12 @@ class NumberAST : public BaseAST
 public:
     int int_const;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return to_string(int_const);
+        return Operand::integer(int_const);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
         return int_const;
     }
@@ -232,61 +340,54 @@ public:
 
 class UnaryExpAST_0 : public BaseAST {
 public:
-    unique_ptr<BaseAST> primary_exp;
+    BaseAST *primary_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return primary_exp->IR_string(id);
+        return primary_exp->gen_IR(ir, symtab);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return primary_exp->get_value();
+        return primary_exp->get_value(symtab);
+    }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return primary_exp->cost(symtab);
     }
 };
 
 class UnaryExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> unary_op;
-    unique_ptr<BaseAST> unary_exp;
+    BaseAST *unary_op;
+    BaseAST *unary_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto unary_exp_id = make_shared<string>();
-        string s = unary_exp->IR_string(unary_exp_id);
-        char op = unary_op->IR_string(nullptr)[0];
+        Operand x = unary_exp->gen_IR(ir, symtab);
+        char op = unary_op->get_ident()[0];
         switch (op)
         {
         case '+':
-        {
-            *id = *unary_exp_id;
-            return s;
-        }
+            return x;
 
         case '-':
-        {
-            *id = "\%" + to_string(val_cnt++);
-            return s + *id + " = sub 0, " + *unary_exp_id + "\n";
-        }
+            return gen_binary(ir, KOOPA_RBO_SUB, Operand::integer(0), x);
+
+        case '!':
+            return gen_binary(ir, KOOPA_RBO_EQ, Operand::integer(0), x);
 
-        case '|':
-        {
-            *id = "\%" + to_string(val_cnt++);
-            return s + *id + " = eq 0, " + *unary_exp_id + "\n";
-        }
-        
         default:
-        {
             assert(false);
         }
-        }
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        int x = unary_exp->get_value();
-        char op = unary_op->IR_string(nullptr)[0];
+        int x = unary_exp->get_value(symtab);
+        char op = unary_op->get_ident()[0];
         switch (op)
         {
         case '+':
@@ -302,14 +403,19 @@ public:
             assert(false);
         }
     }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return 1 + unary_exp->cost(symtab);
+    }
 };
 
 class UnaryOpAST : public BaseAST
 {
 public:
-    string op;
+    string_view op;
 
-    string IR_string(shared_ptr<string> id) const override
+    string_view get_ident() const override
     {
         return op;
     }
@@ -318,66 +424,55 @@ public:
 class MulExpAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> unary_exp;
+    BaseAST *unary_exp;
+
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
+    {
+        return unary_exp->gen_IR(ir, symtab);
+    }
 
-    string IR_string(shared_ptr<string> id) const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return unary_exp->IR_string(id);
+        return unary_exp->get_value(symtab);
     }
 
-    int get_value() const override
+    int cost(const SymbolTable &symtab) const override
     {
-        return unary_exp->get_value();
+        return unary_exp->cost(symtab);
     }
 };
 
 class MulExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> mul_exp;
+    BaseAST *mul_exp;
     char op;
-    unique_ptr<BaseAST> unary_exp;
+    BaseAST *unary_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto mul_exp_id = make_shared<string>();
-        auto unary_exp_id = make_shared<string>();
-        string s1 = mul_exp->IR_string(mul_exp_id);
-        string s2 = unary_exp->IR_string(unary_exp_id);
-        string s3;
-        *id = "%" + to_string(val_cnt++);
+        Operand x = mul_exp->gen_IR(ir, symtab);
+        Operand y = unary_exp->gen_IR(ir, symtab);
         switch (op)
         {
         case '*':
-        {
-            s3 = *id + " = mul " + *mul_exp_id + ", " + *unary_exp_id + "\n";
-            break;
-        }
+            return gen_binary(ir, KOOPA_RBO_MUL, x, y);
 
         case '/':
-        {
-            s3 = *id + " = div " + *mul_exp_id + ", " + *unary_exp_id + "\n";
-            break;
-        }
+            return gen_binary(ir, KOOPA_RBO_DIV, x, y);
 
         case '%':
-        {
-            s3 = *id + " = mod " + *mul_exp_id + ", " + *unary_exp_id + "\n";
-            break;
-        }
-        
+            return gen_binary(ir, KOOPA_RBO_MOD, x, y);
+
         default:
-        {
             assert(false);
         }
-        }
-        return s1 + s2 + s3;
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        int x = mul_exp->get_value();
-        int y = unary_exp->get_value();
+        int x = mul_exp->get_value(symtab);
+        int y = unary_exp->get_value(symtab);
         switch (op)
         {
         case '*':
@@ -393,65 +488,62 @@ public:
             assert(false);
         }
     }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return (op == '*' ? 1 : trap_cost) + mul_exp->cost(symtab) + unary_exp->cost(symtab);
+    }
 };
 
 class AddExpAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> mul_exp;
+    BaseAST *mul_exp;
+
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
+    {
+        return mul_exp->gen_IR(ir, symtab);
+    }
 
-    string IR_string(shared_ptr<string> id) const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return mul_exp->IR_string(id);
+        return mul_exp->get_value(symtab);
     }
 
-    int get_value() const override
+    int cost(const SymbolTable &symtab) const override
     {
-        return mul_exp->get_value();
+        return mul_exp->cost(symtab);
     }
 };
 
 class AddExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> add_exp;
+    BaseAST *add_exp;
     char op;
-    unique_ptr<BaseAST> mul_exp;
+    BaseAST *mul_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto add_exp_id = make_shared<string>();
-        auto mul_exp_id = make_shared<string>();
-        string s1 = add_exp->IR_string(add_exp_id);
-        string s2 = mul_exp->IR_string(mul_exp_id);
-        string s3;
-        *id = "%" + to_string(val_cnt++);
+        Operand x = add_exp->gen_IR(ir, symtab);
+        Operand y = mul_exp->gen_IR(ir, symtab);
         switch (op)
         {
         case '+':
-        {
-            s3 = *id + " = add " + *add_exp_id + ", " + *mul_exp_id + "\n";
-            break;
-        }
+            return gen_binary(ir, KOOPA_RBO_ADD, x, y);
 
         case '-':
-        {
-            s3 = *id + " = sub " + *add_exp_id + ", " + *mul_exp_id + "\n";
-            break;
-        }
-        
+            return gen_binary(ir, KOOPA_RBO_SUB, x, y);
+
         default:
-        {
             assert(false);
         }
-        }
-        return s1 + s2 + s3;
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        int x = add_exp->get_value();
-        int y = mul_exp->get_value();
+        int x = add_exp->get_value(symtab);
+        int y = mul_exp->get_value(symtab);
         switch (op)
         {
         case '+':
@@ -464,77 +556,68 @@ public:
             assert(false);
         }
     }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return 1 + add_exp->cost(symtab) + mul_exp->cost(symtab);
+    }
 };
 
 class RelExpAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> add_exp;
+    BaseAST *add_exp;
+
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
+    {
+        return add_exp->gen_IR(ir, symtab);
+    }
 
-    string IR_string(shared_ptr<string> id) const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return add_exp->IR_string(id);
+        return add_exp->get_value(symtab);
     }
 
-    int get_value() const override
+    int cost(const SymbolTable &symtab) const override
     {
-        return add_exp->get_value();
+        return add_exp->cost(symtab);
     }
 };
 
 class RelExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> rel_exp;
+    BaseAST *rel_exp;
     int op;
-    unique_ptr<BaseAST> add_exp;
+    BaseAST *add_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto rel_exp_id = make_shared<string>();
-        auto add_exp_id = make_shared<string>();
-        string s1 = rel_exp->IR_string(rel_exp_id);
-        string s2 = add_exp->IR_string(add_exp_id);
-        string s3;
-        *id = "%" + to_string(val_cnt++);
+        Operand x = rel_exp->gen_IR(ir, symtab);
+        Operand y = add_exp->gen_IR(ir, symtab);
         switch (op)
         {
         case 0:
-        {
-            s3 = *id + " = lt " + *rel_exp_id + ", " + *add_exp_id + "\n";
-            break;
-        }
+            return gen_binary(ir, KOOPA_RBO_LT, x, y);
 
         case 1:
-        {
-            s3 = *id + " = gt " + *rel_exp_id + ", " + *add_exp_id + "\n";
-            break;
-        }
+            return gen_binary(ir, KOOPA_RBO_GT, x, y);
 
         case 2:
-        {
-            s3 = *id + " = le " + *rel_exp_id + ", " + *add_exp_id + "\n";
-            break;
-        }
+            return gen_binary(ir, KOOPA_RBO_LE, x, y);
 
         case 3:
-        {
-            s3 = *id + " = ge " + *rel_exp_id + ", " + *add_exp_id + "\n";
-            break;
-        }
-        
+            return gen_binary(ir, KOOPA_RBO_GE, x, y);
+
         default:
-        {
             assert(false);
         }
-        }
-        return s1 + s2 + s3;
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        int x = rel_exp->get_value();
-        int y = add_exp->get_value();
+        int x = rel_exp->get_value(symtab);
+        int y = add_exp->get_value(symtab);
         switch (op)
         {
         case 0:
@@ -553,65 +636,62 @@ public:
             assert(false);
         }
     }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return 1 + rel_exp->cost(symtab) + add_exp->cost(symtab);
+    }
 };
 
 class EqExpAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> rel_exp;
+    BaseAST *rel_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return rel_exp->IR_string(id);
+        return rel_exp->gen_IR(ir, symtab);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return rel_exp->get_value();
+        return rel_exp->get_value(symtab);
+    }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return rel_exp->cost(symtab);
     }
 };
 
 class EqExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> eq_exp;
+    BaseAST *eq_exp;
     int op;
-    unique_ptr<BaseAST> rel_exp;
+    BaseAST *rel_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto eq_exp_id = make_shared<string>();
-        auto rel_exp_id = make_shared<string>();
-        string s1 = eq_exp->IR_string(eq_exp_id);
-        string s2 = rel_exp->IR_string(rel_exp_id);
-        string s3;
-        *id = "%" + to_string(val_cnt++);
+        Operand x = eq_exp->gen_IR(ir, symtab);
+        Operand y = rel_exp->gen_IR(ir, symtab);
         switch (op)
         {
         case 0:
-        {
-            s3 = *id + " = eq " + *eq_exp_id + ", " + *rel_exp_id + "\n";
-            break;
-        }
+            return gen_binary(ir, KOOPA_RBO_EQ, x, y);
 
         case 1:
-        {
-            s3 = *id + " = ne " + *eq_exp_id + ", " + *rel_exp_id + "\n";
-            break;
-        }
-        
+            return gen_binary(ir, KOOPA_RBO_NOT_EQ, x, y);
+
         default:
-        {
             assert(false);
         }
-        }
-        return s1 + s2 + s3;
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        int x = eq_exp->get_value();
-        int y = rel_exp->get_value();
+        int x = eq_exp->get_value(symtab);
+        int y = rel_exp->get_value(symtab);
         switch (op)
         {
         case 0:
@@ -624,156 +704,156 @@ public:
             assert(false);
         }
     }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return 1 + eq_exp->cost(symtab) + rel_exp->cost(symtab);
+    }
 };
 
 class LAndExpAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> eq_exp;
+    BaseAST *eq_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return eq_exp->IR_string(id);
+        return eq_exp->gen_IR(ir, symtab);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return eq_exp->get_value();
+        return eq_exp->get_value(symtab);
+    }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return eq_exp->cost(symtab);
     }
 };
 
 class LAndExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> land_exp;
-    unique_ptr<BaseAST> eq_exp;
+    BaseAST *land_exp;
+    BaseAST *eq_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto land_exp_id = make_shared<string>();
-        auto eq_exp_id = make_shared<string>();
-        string s1 = land_exp->IR_string(land_exp_id);
-        string s2 = eq_exp->IR_string(eq_exp_id);
-        string s3, s4, s5;
-        string id1 = "%" + to_string(val_cnt++);
-        string id2 = "%" + to_string(val_cnt++);
-        *id = "%" + to_string(val_cnt++);
-        s3 = id1 + " = ne " + *land_exp_id + ", 0\n";
-        s4 = id2 + " = ne " + *eq_exp_id + ", 0\n";
-        s5 = *id + " = and " + id1 + ", " + id2 + "\n";
-        return s1 + s2 + s3 + s4 + s5;
+        return gen_logic(ir, symtab, KOOPA_RBO_AND, land_exp->gen_IR(ir, symtab), eq_exp);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        int x = land_exp->get_value();
-        int y = eq_exp->get_value();
+        int x = land_exp->get_value(symtab);
+        int y = eq_exp->get_value(symtab);
         return static_cast<int>(x && y);
     }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return 3 + land_exp->cost(symtab) + eq_exp->cost(symtab);
+    }
 };
 
 class LOrExpAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> land_exp;
+    BaseAST *land_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return land_exp->IR_string(id);
+        return land_exp->gen_IR(ir, symtab);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        return land_exp->get_value();
+        return land_exp->get_value(symtab);
+    }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return land_exp->cost(symtab);
     }
 };
 
 class LOrExpAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> lor_exp;
-    unique_ptr<BaseAST> land_exp;
+    BaseAST *lor_exp;
+    BaseAST *land_exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        auto lor_exp_id = make_shared<string>();
-        auto land_exp_id = make_shared<string>();
-        string s1 = lor_exp->IR_string(lor_exp_id);
-        string s2 = land_exp->IR_string(land_exp_id);
-        string s3, s4, s5;
-        string id1 = "%" + to_string(val_cnt++);
-        string id2 = "%" + to_string(val_cnt++);
-        *id = "%" + to_string(val_cnt++);
-        s3 = id1 + " = ne " + *lor_exp_id + ", 0\n";
-        s4 = id2 + " = ne " + *land_exp_id + ", 0\n";
-        s5 = *id + " = or " + id1 + ", " + id2 + "\n";
-        return s1 + s2 + s3 + s4 + s5;
+        return gen_logic(ir, symtab, KOOPA_RBO_OR, lor_exp->gen_IR(ir, symtab), land_exp);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        int x = lor_exp->get_value();
-        int y = land_exp->get_value();
+        int x = lor_exp->get_value(symtab);
+        int y = land_exp->get_value(symtab);
         return static_cast<int>(x || y);
     }
+
+    int cost(const SymbolTable &symtab) const override
+    {
+        return 3 + lor_exp->cost(symtab) + land_exp->cost(symtab);
+    }
 };
 
 class DeclAST_0 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> const_decl;
+    BaseAST *const_decl;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return const_decl->IR_string(nullptr);
+        return const_decl->gen_IR(ir, symtab);
     }
 };
 
 class DeclAST_1 : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> var_decl;
+    BaseAST *var_decl;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return var_decl->IR_string(nullptr);
+        return var_decl->gen_IR(ir, symtab);
     }
 };
 
 class ConstDeclAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> btype;
-    unique_ptr<BaseAST> const_defs;
+    BaseAST *btype;
+    BaseAST *const_defs;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return const_defs->IR_string(nullptr);
+        return const_defs->gen_IR(ir, symtab);
     }
 };
 
 class ConstDefsAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> const_defs;
-    unique_ptr<BaseAST> const_def;
+    ArenaVector<BaseAST *> const_defs;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        string s;
-        if (const_defs != nullptr)
-            s += const_defs->IR_string(nullptr);
-        s += const_def->IR_string(nullptr);
-        return s;
+        for (auto const_def : const_defs)
+            const_def->gen_IR(ir, symtab);
+        return Operand::integer(0);
     }
 };
 
 class BTypeAST : public BaseAST
 {
 public:
-    string btype;
+    string_view btype;
 
-    string IR_string(shared_ptr<string> id) const override
+    string_view get_ident() const override
     {
         return btype;
     }
@@ -782,55 +862,60 @@ public:
 class ConstDefAST : public BaseAST
 {
 public:
-    string ident;
-    unique_ptr<BaseAST> const_init_val;
+    int ident;
+    BaseAST *const_init_val;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        assert(consts.count(ident) == 0);
-        consts[ident] = const_init_val->get_value();
-        return "";
+        symtab.define(ident, Symbol{true, const_init_val->get_value(symtab), Operand::integer(0)});
+        return Operand::integer(0);
     }
 };
 
 class ConstInitValAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> const_exp;
+    BaseAST *const_exp;
+
+    int get_value(const SymbolTable &symtab) const override
+    {
+        return const_exp->get_value(symtab);
+    }
 
-    int get_value() const override
+    int cost(const SymbolTable &symtab) const override
     {
-        return const_exp->get_value();
+        return const_exp->cost(symtab);
     }
 };
 
 class LValAST : public BaseAST
 {
 public:
-    string ident;
+    int ident;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        if (vars.count(ident) != 0)
-        {
-            *id = "\%" + to_string(val_cnt++);
-            return *id + " = load " + vars[ident] + "\n";
-        }
-        if (consts.count(ident) != 0)
-        {
-            *id = to_string(this->get_value());
-            return "";
-        }
-        assert(false);
+        const Symbol *symbol = symtab.lookup(ident);
+        assert(symbol != nullptr);
+        if (symbol->is_const)
+            return Operand::integer(symbol->value);
+        return ir.load(symbol->var);
     }
 
-    int get_value() const override
+    int get_value(const SymbolTable &symtab) const override
     {
-        assert(consts.count(ident) != 0);
-        return consts[ident];
+        const Symbol *symbol = symtab.lookup(ident);
+        assert(symbol != nullptr && symbol->is_const);
+        return symbol->value;
     }
 
-    string get_ident() const override
+    int cost(const SymbolTable &symtab) const override
+    {
+        const Symbol *symbol = symtab.lookup(ident);
+        return symbol != nullptr && !symbol->is_const ? 1 : 0;
+    }
+
+    int get_symbol() const override
     {
         return ident;
     }
@@ -839,72 +924,68 @@ public:
 class ConstExpAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> exp;
+    BaseAST *exp;
+
+    int get_value(const SymbolTable &symtab) const override
+    {
+        return exp->get_value(symtab);
+    }
 
-    int get_value() const override
+    int cost(const SymbolTable &symtab) const override
     {
-        return exp->get_value();
+        return exp->cost(symtab);
     }
 };
 
 class VarDeclAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> btype;
-    unique_ptr<BaseAST> var_defs;
+    BaseAST *btype;
+    BaseAST *var_defs;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        assert(btype->IR_string(nullptr) == "int");
-        return var_defs->IR_string(nullptr);
+        assert(btype->get_ident() == "int");
+        return var_defs->gen_IR(ir, symtab);
     }
 };
 
 class VarDefsAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> var_defs;
-    unique_ptr<BaseAST> var_def;
+    ArenaVector<BaseAST *> var_defs;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        string s;
-        if (var_defs != nullptr)
-            s += var_defs->IR_string(nullptr);
-        s += var_def->IR_string(nullptr);
-        return s;
+        for (auto var_def : var_defs)
+            var_def->gen_IR(ir, symtab);
+        return Operand::integer(0);
     }
 };
 
 class VarDefAST : public BaseAST
 {
 public:
-    string ident;
-    unique_ptr<BaseAST> init_val;
+    int ident;
+    BaseAST *init_val;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        assert(vars.count(ident) == 0);
-        vars[ident] = "\%" + to_string(val_cnt++);
-        if (init_val == nullptr)
-        {
-            return vars[ident] + " = alloc i32\n";
-        } else
-        {
-            auto init_val_id = make_shared<string>();
-            string s = init_val->IR_string(init_val_id);
-            return s + vars[ident] + " = alloc i32\n" + "store " + *init_val_id + ", " + vars[ident] + "\n";
-        }
+        Operand var = ir.alloc();
+        symtab.define(ident, Symbol{false, 0, var});
+        if (init_val != nullptr)
+            ir.store(init_val->gen_IR(ir, symtab), var);
+        return Operand::integer(0);
     }
 };
 
 class InitValAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> exp;
+    BaseAST *exp;
 
-    string IR_string(shared_ptr<string> id) const override
+    Operand gen_IR(IRBuilder &ir, SymbolTable &symtab) const override
     {
-        return exp->IR_string(id);
+        return exp->gen_IR(ir, symtab);
     }
-};
\ No newline at end of file
+};
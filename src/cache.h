@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "build_id.h"
+
+using namespace std;
+
+// The entry layout version and a hash of every source file of the
+// compiler, which the Makefile writes to build_id.h, so output of another
+// build is never served and the same sources always give the same key.
+static const char *compiler_version = "2 " COMPILER_BUILD_ID;
+
+// Content-addressed store of compiler output. An entry is named by a hash
+// of the source, the mode and flags, and the compiler version. It holds
+// the configuration line and the source itself ahead of the output, and a
+// hit must match both exactly, so a hash collision reads as a miss rather
+// than serving another program's output. Entries are written to a
+// temporary file and renamed into place, so a reader never sees half of
+// one, and concurrent compilers storing the same entry race harmlessly.
+// A hit refreshes the entry's modification time, and storing evicts the
+// least recently used entries until the directory fits the size cap.
+class CompileCache
+{
+public:
+    atomic<size_t> hits{0};
+    atomic<size_t> misses{0};
+    atomic<size_t> evictions{0};
+
+    CompileCache(string dir, size_t max_bytes) : dir(move(dir)), max_bytes(max_bytes)
+    {
+        mkdir(this->dir.c_str(), 0777);
+    }
+
+    static string key(const char *src, size_t len, const string &config)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto feed = [&](const char *p, size_t n)
+        {
+            for (size_t i = 0; i < n; ++i)
+                hash = (hash ^ static_cast<unsigned char>(p[i])) * 1099511628211ull;
+        };
+        feed(config.data(), config.size());
+        feed("\n", 1);
+        feed(src, len);
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx-%zx", static_cast<unsigned long long>(hash), len);
+        return name;
+    }
+
+    // Copies the entry for src to output and returns true, or returns false
+    // on a miss.
+    bool fetch(const string &key, const string &config, const char *src, size_t len, const string &output)
+    {
+        string path = dir + "/" + key;
+        string text;
+        string head = header(config, len);
+        bool ok = read_file(path, text) && text.size() >= head.size() + len &&
+                  text.compare(0, head.size(), head) == 0 && memcmp(text.data() + head.size(), src, len) == 0 &&
+                  write_file(output, text.data() + head.size() + len, text.size() - head.size() - len);
+        if (!ok)
+        {
+            ++misses;
+            return false;
+        }
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        ++hits;
+        return true;
+    }
+
+    // Stores the output a miss on src produced under key.
+    void store(const string &key, const string &config, const char *src, size_t len, const string &output)
+    {
+        string text = header(config, len);
+        text.append(src, len);
+        if (!read_file(output, text))
+            return;
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ".tmp.%ld.%zx", static_cast<long>(getpid()),
+                 hash<thread::id>()(this_thread::get_id()));
+        string tmp = dir + "/" + key + suffix;
+        if (!write_file(tmp, text.data(), text.size()) || rename(tmp.c_str(), (dir + "/" + key).c_str()) != 0)
+        {
+            unlink(tmp.c_str());
+            return;
+        }
+        evict();
+    }
+
+private:
+    string dir;
+    size_t max_bytes;
+    mutex evict_lock;
+
+    static string header(const string &config, size_t len)
+    {
+        return config + "\n" + to_string(len) + "\n";
+    }
+
+    // Appends the contents of path to text.
+    static bool read_file(const string &path, string &text)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            return false;
+        char chunk[64 * 1024];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            text.append(chunk, n);
+        bool ok = !ferror(file);
+        fclose(file);
+        return ok;
+    }
+
+    static bool write_file(const string &path, const char *data, size_t size)
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file == nullptr)
+            return false;
+        bool ok = fwrite(data, 1, size, file) == size;
+        return fclose(file) == 0 && ok;
+    }
+
+    void evict()
+    {
+        struct Entry
+        {
+            string path;
+            size_t size;
+            struct timespec mtime;
+        };
+
+        lock_guard<mutex> guard(evict_lock);
+        DIR *d = opendir(dir.c_str());
+        if (d == nullptr)
+            return;
+        vector<Entry> entries;
+        size_t total = 0;
+        while (dirent *ent = readdir(d))
+        {
+            // skip dot files and other writers' temporaries
+            if (ent->d_name[0] == '.' || strstr(ent->d_name, ".tmp.") != nullptr)
+                continue;
+            string path = dir + "/" + ent->d_name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            entries.push_back(Entry{path, static_cast<size_t>(st.st_size), st.st_mtim});
+            total += st.st_size;
+        }
+        closedir(d);
+        if (total <= max_bytes)
+            return;
+
+        sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+             { return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec < b.mtime.tv_sec
+                                                       : a.mtime.tv_nsec < b.mtime.tv_nsec; });
+        for (const auto &entry : entries)
+        {
+            if (total <= max_bytes)
+                break;
+            if (unlink(entry.path.c_str()) != 0)
+                continue;
+            ++evictions;
+            total -= entry.size;
+        }
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+
+using namespace std;
+
+// Appends the blocks control may pass to after bb.
+static void successors(const koopa_raw_basic_block_t &bb, vector<koopa_raw_basic_block_t> &succs)
+{
+    if (bb->insts.len == 0)
+        return;
+    auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+    if (last->kind.tag == KOOPA_RVT_BRANCH)
+    {
+        succs.push_back(last->kind.data.branch.true_bb);
+        succs.push_back(last->kind.data.branch.false_bb);
+    }
+    else if (last->kind.tag == KOOPA_RVT_JUMP)
+        succs.push_back(last->kind.data.jump.target);
+}
+
+// Calls f on every operand field of inst, which may assign a replacement.
+// The program must have been built by RawBuilder, whose nodes are mutable.
+template <typename F>
+static void for_each_operand(koopa_raw_value_t inst, F f)
+{
+    auto &kind = const_cast<koopa_raw_value_data_t *>(inst)->kind;
+    auto each = [&f](koopa_raw_slice_t &args)
+    {
+        for (size_t i = 0; i < args.len; ++i)
+        {
+            auto arg = reinterpret_cast<koopa_raw_value_t>(args.buffer[i]);
+            f(arg);
+            args.buffer[i] = arg;
+        }
+    };
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_LOAD:
+        f(kind.data.load.src);
+        break;
+
+    case KOOPA_RVT_STORE:
+        f(kind.data.store.value);
+        f(kind.data.store.dest);
+        break;
+
+    case KOOPA_RVT_BINARY:
+        f(kind.data.binary.lhs);
+        f(kind.data.binary.rhs);
+        break;
+
+    case KOOPA_RVT_BRANCH:
+        f(kind.data.branch.cond);
+        each(kind.data.branch.true_args);
+        each(kind.data.branch.false_args);
+        break;
+
+    case KOOPA_RVT_JUMP:
+        each(kind.data.jump.args);
+        break;
+
+    case KOOPA_RVT_RETURN:
+        if (kind.data.ret.value != nullptr)
+            f(kind.data.ret.value);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Blocks of one function numbered in layout order, with successor and
+// predecessor lists by number. Block 0 is the entry.
+struct CFG
+{
+    vector<koopa_raw_basic_block_t> bbs;
+    unordered_map<koopa_raw_basic_block_t, size_t> index;
+    vector<vector<size_t>> succ;
+    vector<vector<size_t>> pred;
+
+    explicit CFG(const koopa_raw_function_t &func)
+    {
+        size_t n = func->bbs.len;
+        bbs.resize(n);
+        succ.resize(n);
+        pred.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            bbs[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            index[bbs[i]] = i;
+        }
+        vector<koopa_raw_basic_block_t> succ_bbs;
+        for (size_t i = 0; i < n; ++i)
+        {
+            succ_bbs.clear();
+            successors(bbs[i], succ_bbs);
+            for (auto s : succ_bbs)
+            {
+                succ[i].push_back(index[s]);
+                pred[index[s]].push_back(i);
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return bbs.size();
+    }
+
+    // Immediate dominator of every block (Cooper, Harvey & Kennedy), with
+    // idom[0] == 0 and -1 for blocks unreachable from the entry.
+    vector<int> dominators() const
+    {
+        size_t n = size();
+        vector<size_t> order; // reverse postorder
+        vector<int> rpo_num(n, -1);
+        vector<bool> seen(n, false);
+        vector<pair<size_t, size_t>> stack{{0, 0}};
+        seen[0] = true;
+        while (!stack.empty())
+        {
+            auto &top = stack.back();
+            if (top.second < succ[top.first].size())
+            {
+                size_t s = succ[top.first][top.second++];
+                if (!seen[s])
+                {
+                    seen[s] = true;
+                    stack.push_back({s, 0});
+                }
+                continue;
+            }
+            order.push_back(top.first);
+            stack.pop_back();
+        }
+        reverse(order.begin(), order.end());
+        for (size_t k = 0; k < order.size(); ++k)
+            rpo_num[order[k]] = k;
+
+        vector<int> idom(n, -1);
+        idom[0] = 0;
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t k = 1; k < order.size(); ++k)
+            {
+                size_t b = order[k];
+                int new_idom = -1;
+                for (auto p : pred[b])
+                {
+                    if (idom[p] < 0)
+                        continue;
+                    if (new_idom < 0)
+                    {
+                        new_idom = p;
+                        continue;
+                    }
+                    int x = p, y = new_idom;
+                    while (x != y)
+                    {
+                        while (rpo_num[x] > rpo_num[y])
+                            x = idom[x];
+                        while (rpo_num[y] > rpo_num[x])
+                            y = idom[y];
+                    }
+                    new_idom = x;
+                }
+                if (idom[b] != new_idom)
+                {
+                    idom[b] = new_idom;
+                    changed = true;
+                }
+            }
+        }
+        return idom;
+    }
+};
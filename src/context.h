@@ -0,0 +1,23 @@
+#pragma once
+
+#include "arena.h"
+#include "ast.h"
+#include "source.h"
+#include "stats.h"
+#include "symtab.h"
+
+using namespace std;
+
+// Everything one compilation owns, from the syntax tree to its statistics.
+// Compilations share no state, so any number of them can run at once on
+// separate threads.
+struct CompileContext
+{
+    // first, so that names borrowed from it outlive everything else
+    SourceFile source;
+    Arena arena;
+    Interner symbols{arena};
+    SymbolTable symtab;
+    BaseAST *ast = nullptr;
+    PassStats stats;
+};
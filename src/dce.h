@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "cfg.h"
+#include "koopa.h"
+
+using namespace std;
+
+// Dead code elimination over a program built by RawBuilder, rewriting it in
+// place. Instructions after a block's terminator and blocks the entry
+// cannot reach are dropped first. Then, starting from the terminators,
+// every instruction whose value is needed is marked: the operands of a
+// marked instruction, and the stores to an alloc that a marked load reads.
+// A division or modulo that may trap is marked as well, as the trap is
+// part of what the program does. Everything left unmarked goes: unused
+// arithmetic and loads, stores to allocs nobody reads, and the allocs
+// themselves, which frees their frame slots in the backend.
+class DeadCodeElimination
+{
+public:
+    size_t unreachable_removed = 0;
+    size_t blocks_removed = 0;
+    size_t insts_removed = 0;
+    size_t stores_removed = 0;
+
+    void run(const koopa_raw_program_t &program)
+    {
+        for (size_t i = 0; i < program.funcs.len; ++i)
+            run(const_cast<koopa_raw_function_data_t *>(
+                reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i])));
+    }
+
+private:
+    // marked instructions, open addressing over a power-of-two table with
+    // room for every instruction of the function
+    vector<koopa_raw_value_t> live;
+    unordered_map<koopa_raw_value_t, vector<koopa_raw_value_t>> stores_to;
+    vector<koopa_raw_value_t> work;
+
+    static bool is_terminator(koopa_raw_value_t inst)
+    {
+        auto tag = inst->kind.tag;
+        return tag == KOOPA_RVT_BRANCH || tag == KOOPA_RVT_JUMP || tag == KOOPA_RVT_RETURN;
+    }
+
+    // Whether inst divides by something that may be zero, or -1 for an
+    // INT_MIN dividend: the cases eval_binary refuses to fold.
+    static bool may_trap(koopa_raw_value_t inst)
+    {
+        if (inst->kind.tag != KOOPA_RVT_BINARY)
+            return false;
+        auto &binary = inst->kind.data.binary;
+        if (binary.op != KOOPA_RBO_DIV && binary.op != KOOPA_RBO_MOD)
+            return false;
+        if (binary.rhs->kind.tag != KOOPA_RVT_INTEGER)
+            return true;
+        int32_t divisor = binary.rhs->kind.data.integer.value;
+        if (divisor != -1)
+            return divisor == 0;
+        auto lhs = binary.lhs;
+        return lhs->kind.tag != KOOPA_RVT_INTEGER || lhs->kind.data.integer.value == INT32_MIN;
+    }
+
+    static size_t home(koopa_raw_value_t value)
+    {
+        return (reinterpret_cast<uintptr_t>(value) >> 4) * 0x9e3779b97f4a7c15ull >> 20;
+    }
+
+    bool insert_live(koopa_raw_value_t value)
+    {
+        size_t mask = live.size() - 1;
+        size_t i = home(value) & mask;
+        for (; live[i] != nullptr; i = (i + 1) & mask)
+            if (live[i] == value)
+                return false;
+        live[i] = value;
+        return true;
+    }
+
+    bool is_live(koopa_raw_value_t value) const
+    {
+        size_t mask = live.size() - 1;
+        size_t i = home(value) & mask;
+        for (; live[i] != nullptr; i = (i + 1) & mask)
+            if (live[i] == value)
+                return true;
+        return false;
+    }
+
+    static koopa_raw_basic_block_data_t *block_at(koopa_raw_function_data_t *func, size_t i)
+    {
+        return const_cast<koopa_raw_basic_block_data_t *>(
+            reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+    }
+
+    void run(koopa_raw_function_data_t *func)
+    {
+        if (func->bbs.len == 0)
+            return;
+        prune(func);
+        mark(func);
+        sweep(func);
+    }
+
+    void prune(koopa_raw_function_data_t *func)
+    {
+        for (size_t i = 0; i < func->bbs.len; ++i)
+        {
+            auto bb = block_at(func, i);
+            for (uint32_t j = 0; j < bb->insts.len; ++j)
+                if (is_terminator(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j])))
+                {
+                    unreachable_removed += bb->insts.len - j - 1;
+                    bb->insts.len = j + 1;
+                    break;
+                }
+        }
+
+        CFG cfg(func);
+        vector<bool> reached(cfg.size(), false);
+        vector<size_t> stack{0};
+        reached[0] = true;
+        while (!stack.empty())
+        {
+            size_t b = stack.back();
+            stack.pop_back();
+            for (auto s : cfg.succ[b])
+                if (!reached[s])
+                {
+                    reached[s] = true;
+                    stack.push_back(s);
+                }
+        }
+        uint32_t kept = 0;
+        for (size_t b = 0; b < cfg.size(); ++b)
+        {
+            if (reached[b])
+            {
+                func->bbs.buffer[kept++] = cfg.bbs[b];
+                continue;
+            }
+            ++blocks_removed;
+            unreachable_removed += cfg.bbs[b]->insts.len;
+        }
+        func->bbs.len = kept;
+    }
+
+    void mark(koopa_raw_function_data_t *func)
+    {
+        stores_to.clear();
+        size_t count = 0;
+        for (size_t i = 0; i < func->bbs.len; ++i)
+        {
+            auto bb = block_at(func, i);
+            count += bb->insts.len;
+            for (size_t j = 0; j < bb->insts.len; ++j)
+            {
+                auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+                auto tag = inst->kind.tag;
+                if (tag == KOOPA_RVT_STORE)
+                    stores_to[inst->kind.data.store.dest].push_back(inst);
+                else if ((tag != KOOPA_RVT_BINARY && tag != KOOPA_RVT_LOAD && tag != KOOPA_RVT_ALLOC) ||
+                         may_trap(inst))
+                    work.push_back(inst);
+            }
+        }
+        size_t size = 64;
+        while (size < count * 2)
+            size *= 2;
+        live.assign(size, nullptr);
+        for (auto inst : work)
+            insert_live(inst);
+
+        auto need = [&](koopa_raw_value_t value)
+        {
+            auto tag = value->kind.tag;
+            if (tag != KOOPA_RVT_INTEGER && tag != KOOPA_RVT_BLOCK_ARG_REF && insert_live(value))
+                work.push_back(value);
+        };
+        while (!work.empty())
+        {
+            auto inst = work.back();
+            work.pop_back();
+            for_each_operand(inst, need);
+            if (inst->kind.tag != KOOPA_RVT_ALLOC)
+                continue;
+            auto it = stores_to.find(inst);
+            if (it != stores_to.end())
+                for (auto store : it->second)
+                    need(store);
+        }
+    }
+
+    void sweep(koopa_raw_function_data_t *func)
+    {
+        for (size_t i = 0; i < func->bbs.len; ++i)
+        {
+            auto bb = block_at(func, i);
+            uint32_t kept = 0;
+            for (uint32_t j = 0; j < bb->insts.len; ++j)
+            {
+                auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+                if (is_live(inst))
+                    bb->insts.buffer[kept++] = inst;
+                else if (inst->kind.tag == KOOPA_RVT_STORE)
+                    ++stores_removed;
+                else
+                    ++insts_removed;
+            }
+            bb->insts.len = kept;
+        }
+    }
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+// Writes an ELF32 relocatable object for RV32IM (ilp32, soft float): the
+// machine code in .text and a global function symbol for each function.
+// Branches never leave their function and the code refers to no other
+// symbol, so there is nothing to relocate and no .rela.text section.
+class ElfWriter
+{
+public:
+    void add_function(const char *name, uint32_t offset, uint32_t size)
+    {
+        Elf32_Sym sym = {};
+        sym.st_name = add_string(strtab, name);
+        sym.st_value = offset;
+        sym.st_size = size;
+        sym.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+        sym.st_shndx = text_index;
+        globals.push_back(sym);
+    }
+
+    void write(FILE *file, const string &text)
+    {
+        string shstrtab(1, '\0');
+        uint32_t text_name = add_string(shstrtab, ".text");
+        uint32_t symtab_name = add_string(shstrtab, ".symtab");
+        uint32_t strtab_name = add_string(shstrtab, ".strtab");
+        uint32_t shstrtab_name = add_string(shstrtab, ".shstrtab");
+
+        // the null symbol and the section symbol of .text come first, as
+        // locals precede globals
+        vector<Elf32_Sym> syms(2, Elf32_Sym{});
+        syms[1].st_info = ELF32_ST_INFO(STB_LOCAL, STT_SECTION);
+        syms[1].st_shndx = text_index;
+        syms.insert(syms.end(), globals.begin(), globals.end());
+
+        string image(sizeof(Elf32_Ehdr), '\0');
+        uint32_t text_off = append(image, text.data(), text.size());
+        uint32_t symtab_off = append(image, syms.data(), syms.size() * sizeof(Elf32_Sym));
+        uint32_t strtab_off = append(image, strtab.data(), strtab.size());
+        uint32_t shstrtab_off = append(image, shstrtab.data(), shstrtab.size());
+
+        Elf32_Shdr shdrs[5] = {};
+        shdrs[text_index] = section(text_name, SHT_PROGBITS, text_off, text.size(), 4);
+        shdrs[text_index].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+        shdrs[2] = section(symtab_name, SHT_SYMTAB, symtab_off, syms.size() * sizeof(Elf32_Sym), 4);
+        shdrs[2].sh_link = 3;
+        shdrs[2].sh_info = 2;
+        shdrs[2].sh_entsize = sizeof(Elf32_Sym);
+        shdrs[3] = section(strtab_name, SHT_STRTAB, strtab_off, strtab.size(), 1);
+        shdrs[4] = section(shstrtab_name, SHT_STRTAB, shstrtab_off, shstrtab.size(), 1);
+        uint32_t shdr_off = append(image, shdrs, sizeof(shdrs));
+
+        Elf32_Ehdr ehdr = {};
+        memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+        ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        ehdr.e_type = ET_REL;
+        ehdr.e_machine = EM_RISCV;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_shoff = shdr_off;
+        ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+        ehdr.e_shentsize = sizeof(Elf32_Shdr);
+        ehdr.e_shnum = 5;
+        ehdr.e_shstrndx = 4;
+        memcpy(&image[0], &ehdr, sizeof(ehdr));
+
+        fwrite(image.data(), 1, image.size(), file);
+    }
+
+private:
+    static const uint16_t text_index = 1;
+
+    string strtab = string(1, '\0');
+    vector<Elf32_Sym> globals;
+
+    static uint32_t add_string(string &table, const char *s)
+    {
+        uint32_t off = table.size();
+        table.append(s, strlen(s) + 1);
+        return off;
+    }
+
+    // Appends data at the next 4-byte boundary and returns its offset.
+    static uint32_t append(string &image, const void *data, size_t size)
+    {
+        image.resize((image.size() + 3) & ~size_t(3), '\0');
+        uint32_t off = image.size();
+        image.append(static_cast<const char *>(data), size);
+        return off;
+    }
+
+    static Elf32_Shdr section(uint32_t name, uint32_t type, uint32_t offset, uint32_t size, uint32_t align)
+    {
+        Elf32_Shdr shdr = {};
+        shdr.sh_name = name;
+        shdr.sh_type = type;
+        shdr.sh_offset = offset;
+        shdr.sh_size = size;
+        shdr.sh_addralign = align;
+        return shdr;
+    }
+};
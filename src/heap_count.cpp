@@ -0,0 +1,78 @@
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "stats.h"
+
+using namespace std;
+
+// Replaces the global allocation functions to count every heap allocation
+// for --time-passes. They live in their own file so that no caller sees
+// operator delete inlined to free and takes it for a mismatched pair.
+
+thread_local size_t heap_allocs = 0;
+thread_local size_t heap_bytes = 0;
+
+static void *counted_alloc(size_t size, size_t align)
+{
+  ++heap_allocs;
+  heap_bytes += size;
+  size = size ? size : 1;
+  if (align <= alignof(max_align_t))
+    return malloc(size);
+  // aligned_alloc takes a size that is a multiple of the alignment
+  return aligned_alloc(align, (size + align - 1) & ~(align - 1));
+}
+
+void *operator new(size_t size)
+{
+  if (void *p = counted_alloc(size, 0))
+    return p;
+  throw bad_alloc();
+}
+
+void *operator new(size_t size, align_val_t align)
+{
+  if (void *p = counted_alloc(size, static_cast<size_t>(align)))
+    return p;
+  throw bad_alloc();
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+  return counted_alloc(size, 0);
+}
+
+void *operator new(size_t size, align_val_t align, const nothrow_t &) noexcept
+{
+  return counted_alloc(size, static_cast<size_t>(align));
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t, align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, const nothrow_t &) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, align_val_t, const nothrow_t &) noexcept
+{
+  free(p);
+}
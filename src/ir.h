@@ -0,0 +1,272 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+
+using namespace std;
+
+// An instruction operand: an immediate, or the numbered value %value.
+struct Operand
+{
+    bool imm;
+    int value;
+
+    static Operand integer(int value)
+    {
+        return Operand{true, value};
+    }
+
+    static Operand named(int value)
+    {
+        return Operand{false, value};
+    }
+};
+
+// A basic block, numbered by the builder in creation order.
+struct Block
+{
+    int id;
+};
+
+static const char *binary_op_name[] = {
+    "ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul",
+    "div", "mod", "and", "or", "xor", "shl", "shr", "sar"};
+
+// Evaluates op on two constants with the wrap-around semantics of the
+// target. Returns false when the result must be left to run time:
+// division or modulo by zero, and INT_MIN / -1.
+static bool eval_binary(koopa_raw_binary_op_t op, int lhs, int rhs, int &result)
+{
+    uint32_t x = static_cast<uint32_t>(lhs), y = static_cast<uint32_t>(rhs);
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+        result = lhs != rhs;
+        return true;
+    case KOOPA_RBO_EQ:
+        result = lhs == rhs;
+        return true;
+    case KOOPA_RBO_GT:
+        result = lhs > rhs;
+        return true;
+    case KOOPA_RBO_LT:
+        result = lhs < rhs;
+        return true;
+    case KOOPA_RBO_GE:
+        result = lhs >= rhs;
+        return true;
+    case KOOPA_RBO_LE:
+        result = lhs <= rhs;
+        return true;
+    case KOOPA_RBO_ADD:
+        result = static_cast<int>(x + y);
+        return true;
+    case KOOPA_RBO_SUB:
+        result = static_cast<int>(x - y);
+        return true;
+    case KOOPA_RBO_MUL:
+        result = static_cast<int>(x * y);
+        return true;
+    case KOOPA_RBO_DIV:
+    case KOOPA_RBO_MOD:
+        if (rhs == 0 || (lhs == INT32_MIN && rhs == -1))
+            return false;
+        result = op == KOOPA_RBO_DIV ? lhs / rhs : lhs % rhs;
+        return true;
+    case KOOPA_RBO_AND:
+        result = lhs & rhs;
+        return true;
+    case KOOPA_RBO_OR:
+        result = lhs | rhs;
+        return true;
+    case KOOPA_RBO_XOR:
+        result = lhs ^ rhs;
+        return true;
+    case KOOPA_RBO_SHL:
+        result = static_cast<int>(x << (y & 31));
+        return true;
+    case KOOPA_RBO_SHR:
+        result = static_cast<int>(x >> (y & 31));
+        return true;
+    case KOOPA_RBO_SAR:
+        result = lhs >> (rhs & 31);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Interface the AST lowers itself through. IRWriter prints Koopa text for
+// -koopa; RawBuilder (raw_builder.h) builds the in-memory raw program that
+// the RISC-V backend consumes, without a print/parse round trip.
+class IRBuilder
+{
+public:
+    virtual ~IRBuilder() = default;
+
+    virtual void func_begin(const string &ident) = 0;
+    virtual void func_end() = 0;
+    // Creates a block; it is placed in the function by set_block().
+    virtual Block new_block(const char *prefix) = 0;
+    virtual void set_block(Block bb) = 0;
+    virtual Operand alloc() = 0;
+    virtual Operand load(Operand src) = 0;
+    virtual void store(Operand value, Operand dest) = 0;
+    virtual Operand binary(koopa_raw_binary_op_t op, Operand lhs, Operand rhs) = 0;
+    virtual void br(Operand cond, Block true_bb, Block false_bb) = 0;
+    virtual void jump(Block target) = 0;
+    virtual void ret(Operand value) = 0;
+
+    size_t inst_count() const
+    {
+        return insts;
+    }
+
+protected:
+    size_t insts = 0;
+
+    // Block names are the prefix itself the first time it is used and
+    // prefix_N afterwards, e.g. %entry, %land_rhs, %land_rhs_1.
+    string block_name(const char *prefix)
+    {
+        int n = prefix_uses[prefix]++;
+        if (n == 0)
+            return string("%") + prefix;
+        return string("%") + prefix + "_" + to_string(n);
+    }
+
+private:
+    unordered_map<string, int> prefix_uses;
+};
+
+// Append-only sink for Koopa IR text. Every instruction is written exactly
+// once into a single buffer, so the whole program is produced in one pass.
+class IRWriter : public IRBuilder
+{
+public:
+    IRWriter()
+    {
+        buf.reserve(1 << 16);
+    }
+
+    IRWriter &operator<<(const char *s)
+    {
+        buf.append(s);
+        return *this;
+    }
+
+    IRWriter &operator<<(const string &s)
+    {
+        buf.append(s);
+        return *this;
+    }
+
+    IRWriter &operator<<(int x)
+    {
+        char tmp[16];
+        auto res = to_chars(tmp, tmp + sizeof(tmp), x);
+        buf.append(tmp, res.ptr);
+        return *this;
+    }
+
+    IRWriter &operator<<(Operand x)
+    {
+        if (!x.imm)
+            buf += '%';
+        return *this << x.value;
+    }
+
+    void func_begin(const string &ident) override
+    {
+        *this << "fun @" << ident << "(): i32\n{\n";
+    }
+
+    void func_end() override
+    {
+        *this << "}\n";
+    }
+
+    Block new_block(const char *prefix) override
+    {
+        block_names.push_back(block_name(prefix));
+        return Block{static_cast<int>(block_names.size()) - 1};
+    }
+
+    void set_block(Block bb) override
+    {
+        *this << block_names[bb.id] << ":\n";
+    }
+
+    Operand alloc() override
+    {
+        Operand dest = new_value();
+        ++insts;
+        *this << dest << " = alloc i32\n";
+        return dest;
+    }
+
+    Operand load(Operand src) override
+    {
+        Operand dest = new_value();
+        ++insts;
+        *this << dest << " = load " << src << "\n";
+        return dest;
+    }
+
+    void store(Operand value, Operand dest) override
+    {
+        ++insts;
+        *this << "store " << value << ", " << dest << "\n";
+    }
+
+    Operand binary(koopa_raw_binary_op_t op, Operand lhs, Operand rhs) override
+    {
+        Operand dest = new_value();
+        ++insts;
+        *this << dest << " = " << binary_op_name[op] << " " << lhs << ", " << rhs << "\n";
+        return dest;
+    }
+
+    void br(Operand cond, Block true_bb, Block false_bb) override
+    {
+        ++insts;
+        *this << "br " << cond << ", " << block_names[true_bb.id] << ", " << block_names[false_bb.id] << "\n";
+    }
+
+    void jump(Block target) override
+    {
+        ++insts;
+        *this << "jump " << block_names[target.id] << "\n";
+    }
+
+    void ret(Operand value) override
+    {
+        ++insts;
+        *this << "ret " << value << "\n";
+    }
+
+    const string &str() const
+    {
+        return buf;
+    }
+
+    void write(FILE *out) const
+    {
+        fwrite(buf.data(), 1, buf.size(), out);
+    }
+
+private:
+    string buf;
+    int val_cnt = 0;
+    vector<string> block_names;
+
+    Operand new_value()
+    {
+        return Operand::named(val_cnt++);
+    }
+};
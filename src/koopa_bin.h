@@ -0,0 +1,573 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "raw_builder.h"
+
+using namespace std;
+
+// A compact binary form of a raw program, written by -koopa-bin and read
+// back in place of SysY source, so the backend can run as a separate stage
+// without printing and parsing Koopa text.
+//
+//   file     = magic, strings, varint count, function*
+//   strings  = varint count, (varint length, bytes)*
+//   function = varint section length, name, varint count, block*
+//   block    = name, varint params, varint count, inst*
+//
+// Names are indices into the string table. Parameters and instructions
+// are numbered together in layout order, and an operand is a varint:
+// 0 for none, (number + 1) << 1 for a value, zigzag(integer) << 1 | 1 for
+// a constant. Blocks are referred to by their index in the function.
+static const char koopa_bin_magic[4] = {'K', 'P', 'B', '1'};
+
+enum class BinInst : uint8_t
+{
+    alloc,
+    load,
+    store,
+    binary,
+    branch,
+    jump,
+    ret
+};
+
+class KoopaBinWriter
+{
+public:
+    explicit KoopaBinWriter(const koopa_raw_program_t &program)
+    {
+        string body;
+        put_varint(body, program.funcs.len);
+        for (size_t i = 0; i < program.funcs.len; ++i)
+        {
+            section.clear();
+            encode(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]));
+            put_varint(body, section.size());
+            body += section;
+        }
+
+        buf.append(koopa_bin_magic, sizeof(koopa_bin_magic));
+        put_varint(buf, strings.size());
+        for (auto s : strings)
+        {
+            put_varint(buf, s.size());
+            buf += s;
+        }
+        buf += body;
+    }
+
+    const string &str() const
+    {
+        return buf;
+    }
+
+    void write(FILE *out) const
+    {
+        fwrite(buf.data(), 1, buf.size(), out);
+    }
+
+private:
+    string buf;
+    string section;
+    vector<string_view> strings;
+    unordered_map<string_view, uint32_t> string_ids;
+    unordered_map<koopa_raw_value_t, uint32_t> value_ids;
+    unordered_map<koopa_raw_basic_block_t, uint32_t> block_ids;
+
+    static void put_varint(string &out, uint64_t x)
+    {
+        while (x >= 0x80)
+        {
+            out += static_cast<char>(x | 0x80);
+            x >>= 7;
+        }
+        out += static_cast<char>(x);
+    }
+
+    void put_string(const char *s)
+    {
+        auto res = string_ids.emplace(s, strings.size());
+        if (res.second)
+            strings.push_back(s);
+        put_varint(section, res.first->second);
+    }
+
+    void put_operand(koopa_raw_value_t value)
+    {
+        if (value == nullptr)
+            put_varint(section, 0);
+        else if (value->kind.tag == KOOPA_RVT_INTEGER)
+        {
+            int32_t x = value->kind.data.integer.value;
+            uint32_t zigzag = static_cast<uint32_t>(x) << 1 ^ static_cast<uint32_t>(x >> 31);
+            put_varint(section, static_cast<uint64_t>(zigzag) << 1 | 1);
+        }
+        else
+            put_varint(section, static_cast<uint64_t>(value_ids.at(value) + 1) << 1);
+    }
+
+    void put_target(koopa_raw_basic_block_t bb, const koopa_raw_slice_t &args)
+    {
+        put_varint(section, block_ids.at(bb));
+        put_varint(section, args.len);
+        for (size_t i = 0; i < args.len; ++i)
+            put_operand(reinterpret_cast<koopa_raw_value_t>(args.buffer[i]));
+    }
+
+    void encode(koopa_raw_function_t func)
+    {
+        value_ids.clear();
+        block_ids.clear();
+        for (size_t i = 0; i < func->bbs.len; ++i)
+        {
+            auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            block_ids[bb] = i;
+            for (size_t j = 0; j < bb->params.len; ++j)
+                value_ids.emplace(reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j]), value_ids.size());
+            for (size_t j = 0; j < bb->insts.len; ++j)
+                value_ids.emplace(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]), value_ids.size());
+        }
+
+        put_string(func->name);
+        put_varint(section, func->bbs.len);
+        for (size_t i = 0; i < func->bbs.len; ++i)
+        {
+            auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            put_string(bb->name);
+            put_varint(section, bb->params.len);
+            put_varint(section, bb->insts.len);
+            for (size_t j = 0; j < bb->insts.len; ++j)
+                encode(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]));
+        }
+    }
+
+    void encode(koopa_raw_value_t inst)
+    {
+        const auto &kind = inst->kind;
+        switch (kind.tag)
+        {
+        case KOOPA_RVT_ALLOC:
+            section += static_cast<char>(BinInst::alloc);
+            break;
+
+        case KOOPA_RVT_LOAD:
+            section += static_cast<char>(BinInst::load);
+            put_operand(kind.data.load.src);
+            break;
+
+        case KOOPA_RVT_STORE:
+            section += static_cast<char>(BinInst::store);
+            put_operand(kind.data.store.value);
+            put_operand(kind.data.store.dest);
+            break;
+
+        case KOOPA_RVT_BINARY:
+            section += static_cast<char>(BinInst::binary);
+            section += static_cast<char>(kind.data.binary.op);
+            put_operand(kind.data.binary.lhs);
+            put_operand(kind.data.binary.rhs);
+            break;
+
+        case KOOPA_RVT_BRANCH:
+            section += static_cast<char>(BinInst::branch);
+            put_operand(kind.data.branch.cond);
+            put_target(kind.data.branch.true_bb, kind.data.branch.true_args);
+            put_target(kind.data.branch.false_bb, kind.data.branch.false_args);
+            break;
+
+        case KOOPA_RVT_JUMP:
+            section += static_cast<char>(BinInst::jump);
+            put_target(kind.data.jump.target, kind.data.jump.args);
+            break;
+
+        case KOOPA_RVT_RETURN:
+            section += static_cast<char>(BinInst::ret);
+            put_operand(kind.data.ret.value);
+            break;
+
+        default:
+            assert(false);
+        }
+    }
+};
+
+// Rebuilds the raw program from the binary form. The reader owns every
+// node and must outlive the program. read() returns false on malformed
+// input instead of trusting it.
+class KoopaBinReader
+{
+public:
+    static bool is_binary(const char *data, size_t size)
+    {
+        return size >= sizeof(koopa_bin_magic) && memcmp(data, koopa_bin_magic, sizeof(koopa_bin_magic)) == 0;
+    }
+
+    KoopaBinReader()
+    {
+        i32_ptr_type.tag = KOOPA_RTT_POINTER;
+        i32_ptr_type.data.pointer.base = &raw_i32_type;
+        func_type.tag = KOOPA_RTT_FUNCTION;
+        func_type.data.function.params = koopa_raw_slice_t{nullptr, 0, KOOPA_RSIK_TYPE};
+        func_type.data.function.ret = &raw_i32_type;
+    }
+
+    bool read(const char *data, size_t size, koopa_raw_program_t &program)
+    {
+        if (!is_binary(data, size))
+            return false;
+        pos = data + sizeof(koopa_bin_magic);
+        end = data + size;
+
+        uint64_t n = get_varint();
+        for (uint64_t i = 0; ok && i < n; ++i)
+        {
+            uint64_t len = get_varint();
+            if (!ok || len > static_cast<uint64_t>(end - pos))
+                return false;
+            strings.emplace_back(pos, len);
+            pos += len;
+        }
+
+        vector<const void *> funcs;
+        n = get_varint();
+        for (uint64_t i = 0; ok && i < n; ++i)
+        {
+            uint64_t len = get_varint();
+            if (!ok || len > static_cast<uint64_t>(end - pos))
+                return false;
+            // reads stop at the end of the section
+            const char *file_end = end;
+            end = pos + len;
+            funcs.push_back(decode_function());
+            ok = ok && pos == end;
+            end = file_end;
+        }
+        if (!ok || pos != end)
+            return false;
+
+        program.values = koopa_raw_slice_t{nullptr, 0, KOOPA_RSIK_VALUE};
+        program.funcs = make_slice(move(funcs), KOOPA_RSIK_FUNCTION);
+        return true;
+    }
+
+    size_t inst_count() const
+    {
+        return insts;
+    }
+
+private:
+    koopa_raw_type_kind_t i32_ptr_type;
+    koopa_raw_type_kind_t func_type;
+
+    const char *pos = nullptr;
+    const char *end = nullptr;
+    bool ok = true;
+    size_t insts = 0;
+
+    deque<string> strings;
+    NodePool<koopa_raw_value_data_t> values;
+    deque<koopa_raw_basic_block_data_t> bbs;
+    deque<koopa_raw_function_data_t> funcs;
+    deque<vector<const void *>> lists;
+    unordered_map<int32_t, koopa_raw_value_t> integers;
+
+    // the function being read: its blocks, and its parameters and
+    // instructions by number
+    vector<koopa_raw_basic_block_data_t *> func_bbs;
+    vector<koopa_raw_value_data_t *> func_values;
+    // values defined before the instruction being filled in; operands
+    // must be among them, as RawPrinter names values in layout order
+    size_t defined = 0;
+
+    koopa_raw_slice_t make_slice(vector<const void *> items, koopa_raw_slice_item_kind_t kind)
+    {
+        auto &list = lists.emplace_back(move(items));
+        return koopa_raw_slice_t{list.data(), static_cast<uint32_t>(list.size()), kind};
+    }
+
+    uint64_t get_varint()
+    {
+        uint64_t x = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (pos == end)
+                break;
+            uint8_t byte = static_cast<uint8_t>(*pos++);
+            x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return x;
+        }
+        ok = false;
+        return 0;
+    }
+
+    uint8_t get_byte()
+    {
+        if (pos == end)
+        {
+            ok = false;
+            return 0;
+        }
+        return static_cast<uint8_t>(*pos++);
+    }
+
+    // Reads a count of items that take at least a byte each, so a corrupt
+    // count cannot make the reader allocate more than the section holds.
+    uint64_t get_count()
+    {
+        uint64_t n = get_varint();
+        if (n > static_cast<uint64_t>(end - pos))
+            ok = false;
+        return ok ? n : 0;
+    }
+
+    const char *get_string()
+    {
+        uint64_t id = get_varint();
+        if (id >= strings.size())
+        {
+            ok = false;
+            return "";
+        }
+        return strings[id].c_str();
+    }
+
+    koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag)
+    {
+        auto &value = values.alloc();
+        value.ty = ty;
+        value.name = nullptr;
+        value.used_by = koopa_raw_slice_t{nullptr, 0, KOOPA_RSIK_VALUE};
+        value.kind.tag = tag;
+        return &value;
+    }
+
+    koopa_raw_value_t get_operand()
+    {
+        uint64_t code = get_varint();
+        if (code == 0)
+            return nullptr;
+        if (code & 1)
+        {
+            uint32_t zigzag = static_cast<uint32_t>(code >> 1);
+            int32_t x = static_cast<int32_t>(zigzag >> 1 ^ -(zigzag & 1));
+            auto &value = integers[x];
+            if (value == nullptr)
+            {
+                auto integer = new_value(&raw_i32_type, KOOPA_RVT_INTEGER);
+                integer->kind.data.integer.value = x;
+                value = integer;
+            }
+            return value;
+        }
+        uint64_t id = (code >> 1) - 1;
+        if (id >= defined)
+        {
+            ok = false;
+            return nullptr;
+        }
+        return func_values[id];
+    }
+
+    // Like get_operand, but the operand must be an i32.
+    koopa_raw_value_t get_value()
+    {
+        auto value = get_operand();
+        if (value == nullptr || value->ty != &raw_i32_type)
+            ok = false;
+        return value;
+    }
+
+    koopa_raw_value_t get_alloc()
+    {
+        auto value = get_operand();
+        if (value == nullptr || value->kind.tag != KOOPA_RVT_ALLOC)
+            ok = false;
+        return value;
+    }
+
+    koopa_raw_basic_block_t get_target(koopa_raw_slice_t &args)
+    {
+        uint64_t id = get_varint();
+        vector<const void *> list(get_count());
+        for (auto &arg : list)
+            arg = get_value();
+        args = make_slice(move(list), KOOPA_RSIK_VALUE);
+        // nothing may jump back to the entry block
+        if (id == 0 || id >= func_bbs.size() || func_bbs[id]->params.len != args.len)
+        {
+            ok = false;
+            return nullptr;
+        }
+        return func_bbs[id];
+    }
+
+    static bool is_terminator(koopa_raw_value_t inst)
+    {
+        auto tag = inst->kind.tag;
+        return tag == KOOPA_RVT_BRANCH || tag == KOOPA_RVT_JUMP || tag == KOOPA_RVT_RETURN;
+    }
+
+    // Blocks are read twice: first to create every block, parameter and
+    // instruction, since a branch may target a block laid out later, then
+    // to fill them in. Operands, unlike targets, must come earlier.
+    koopa_raw_function_t decode_function()
+    {
+        auto &func = funcs.emplace_back();
+        func.ty = &func_type;
+        func.name = get_string();
+        func.params = koopa_raw_slice_t{nullptr, 0, KOOPA_RSIK_VALUE};
+
+        func_bbs.clear();
+        func_values.clear();
+        const char *start = pos;
+        uint64_t n = get_count();
+        if (n == 0)
+            ok = false;
+        for (uint64_t i = 0; ok && i < n; ++i)
+        {
+            auto &bb = bbs.emplace_back();
+            bb.name = get_string();
+            bb.used_by = koopa_raw_slice_t{nullptr, 0, KOOPA_RSIK_VALUE};
+            vector<const void *> params(get_count());
+            for (size_t j = 0; j < params.size(); ++j)
+            {
+                auto param = new_value(&raw_i32_type, KOOPA_RVT_BLOCK_ARG_REF);
+                param->kind.data.block_arg_ref.index = j;
+                params[j] = param;
+                func_values.push_back(param);
+            }
+            bb.params = make_slice(move(params), KOOPA_RSIK_VALUE);
+            vector<const void *> list(get_count());
+            for (auto &inst : list)
+            {
+                auto value = skip_inst();
+                inst = value;
+                func_values.push_back(value);
+            }
+            // every block ends in its only terminator, and the entry takes
+            // no arguments
+            for (size_t j = 0; j < list.size(); ++j)
+                if (is_terminator(reinterpret_cast<koopa_raw_value_t>(list[j])) != (j + 1 == list.size()))
+                    ok = false;
+            if (list.empty() || (i == 0 && bb.params.len != 0))
+                ok = false;
+            insts += list.size();
+            bb.insts = make_slice(move(list), KOOPA_RSIK_VALUE);
+            func_bbs.push_back(&bb);
+        }
+
+        pos = start;
+        defined = 0;
+        get_count();
+        for (auto bb : func_bbs)
+        {
+            get_string();
+            defined += get_count();
+            get_count();
+            for (size_t j = 0; ok && j < bb->insts.len; ++j, ++defined)
+                decode_inst(func_values[defined]);
+        }
+
+        vector<const void *> list(func_bbs.begin(), func_bbs.end());
+        func.bbs = make_slice(move(list), KOOPA_RSIK_BASIC_BLOCK);
+        return &func;
+    }
+
+    // Creates the node for the next instruction and steps over it.
+    koopa_raw_value_data_t *skip_inst()
+    {
+        auto tag = static_cast<BinInst>(get_byte());
+        switch (tag)
+        {
+        case BinInst::alloc:
+            return new_value(&i32_ptr_type, KOOPA_RVT_ALLOC);
+        case BinInst::load:
+            get_varint();
+            return new_value(&raw_i32_type, KOOPA_RVT_LOAD);
+        case BinInst::store:
+            get_varint();
+            get_varint();
+            return new_value(&raw_unit_type, KOOPA_RVT_STORE);
+        case BinInst::binary:
+            get_byte();
+            get_varint();
+            get_varint();
+            return new_value(&raw_i32_type, KOOPA_RVT_BINARY);
+        case BinInst::branch:
+            get_varint();
+            for (int k = 0; k < 2; ++k)
+            {
+                get_varint();
+                for (uint64_t n = get_count(); ok && n > 0; --n)
+                    get_varint();
+            }
+            return new_value(&raw_unit_type, KOOPA_RVT_BRANCH);
+        case BinInst::jump:
+            get_varint();
+            for (uint64_t n = get_count(); ok && n > 0; --n)
+                get_varint();
+            return new_value(&raw_unit_type, KOOPA_RVT_JUMP);
+        case BinInst::ret:
+            get_varint();
+            return new_value(&raw_unit_type, KOOPA_RVT_RETURN);
+        default:
+            ok = false;
+            return new_value(&raw_unit_type, KOOPA_RVT_RETURN);
+        }
+    }
+
+    void decode_inst(koopa_raw_value_data_t *inst)
+    {
+        auto &kind = inst->kind;
+        get_byte();
+        switch (kind.tag)
+        {
+        case KOOPA_RVT_LOAD:
+            kind.data.load.src = get_alloc();
+            break;
+
+        case KOOPA_RVT_STORE:
+            kind.data.store.value = get_value();
+            kind.data.store.dest = get_alloc();
+            break;
+
+        case KOOPA_RVT_BINARY:
+        {
+            uint8_t op = get_byte();
+            if (op > KOOPA_RBO_SAR)
+                ok = false;
+            kind.data.binary.op = static_cast<koopa_raw_binary_op_t>(op);
+            kind.data.binary.lhs = get_value();
+            kind.data.binary.rhs = get_value();
+            break;
+        }
+
+        case KOOPA_RVT_BRANCH:
+            kind.data.branch.cond = get_value();
+            kind.data.branch.true_bb = get_target(kind.data.branch.true_args);
+            kind.data.branch.false_bb = get_target(kind.data.branch.false_args);
+            break;
+
+        case KOOPA_RVT_JUMP:
+            kind.data.jump.target = get_target(kind.data.jump.args);
+            break;
+
+        case KOOPA_RVT_RETURN:
+            // every function returns i32
+            kind.data.ret.value = get_value();
+            break;
+
+        default:
+            break;
+        }
+    }
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "koopa.h"
+
+using namespace std;
+
+// Local value numbering over a program built by RawBuilder, rewriting it in
+// place. Within each block a binary operation that repeats an earlier one
+// on the same operands is replaced by the earlier result, and a load is
+// replaced by the value last loaded from or stored to the same alloc in
+// the block. Every address is an alloc of its own, so only a store to
+// that alloc changes what a load reads. Constants compare by value.
+class LocalValueNumbering
+{
+public:
+    size_t exprs_removed = 0;
+    size_t loads_removed = 0;
+
+    void run(const koopa_raw_program_t &program)
+    {
+        for (size_t i = 0; i < program.funcs.len; ++i)
+            run(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]));
+    }
+
+private:
+    struct Expr
+    {
+        uint64_t lhs, rhs;
+        uint32_t op;
+
+        bool operator==(const Expr &other) const
+        {
+            return lhs == other.lhs && rhs == other.rhs && op == other.op;
+        }
+    };
+
+    // Open-addressing map from Expr to value. Slots carry the generation
+    // they were filled in, so clearing a table between blocks costs
+    // nothing however large it grew.
+    class Table
+    {
+    public:
+        Table() : slots(64, Slot{})
+        {
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        void clear()
+        {
+            ++gen;
+            count = 0;
+        }
+
+        // Makes room for n entries without growing.
+        void reserve(size_t n)
+        {
+            if (n * 2 <= slots.size())
+                return;
+            size_t size = slots.size();
+            while (n * 2 > size)
+                size *= 2;
+            vector<Slot> old(size, Slot{});
+            old.swap(slots);
+            rehash(old);
+        }
+
+        koopa_raw_value_t find(const Expr &key) const
+        {
+            size_t mask = slots.size() - 1;
+            for (size_t i = hash(key) & mask; slots[i].gen == gen; i = (i + 1) & mask)
+                if (slots[i].holds(key))
+                    return slots[i].value;
+            return nullptr;
+        }
+
+        // Returns the value already mapped from key and false, or maps key
+        // to value and returns value and true.
+        pair<koopa_raw_value_t, bool> insert(const Expr &key, koopa_raw_value_t value)
+        {
+            Slot &slot = lookup(key);
+            if (slot.gen == gen)
+                return {slot.value, false};
+            fill(slot, key, value);
+            return {value, true};
+        }
+
+        void assign(const Expr &key, koopa_raw_value_t value)
+        {
+            Slot &slot = lookup(key);
+            if (slot.gen == gen)
+                slot.value = value;
+            else
+                fill(slot, key, value);
+        }
+
+    private:
+        struct Slot
+        {
+            uint64_t lhs, rhs;
+            uint32_t op;
+            uint32_t gen; // filled when equal to the table's
+            koopa_raw_value_t value;
+
+            bool holds(const Expr &key) const
+            {
+                return lhs == key.lhs && rhs == key.rhs && op == key.op;
+            }
+        };
+
+        vector<Slot> slots; // size is a power of two
+        size_t count = 0;
+        uint32_t gen = 1;
+
+        static size_t hash(const Expr &e)
+        {
+            uint64_t h = e.lhs * 0x9e3779b97f4a7c15ull + e.rhs;
+            h = (h ^ (h >> 29) ^ e.op) * 0xbf58476d1ce4e5b9ull;
+            return h ^ (h >> 32);
+        }
+
+        // The slot holding key, or the empty one where it belongs.
+        Slot &lookup(const Expr &key)
+        {
+            size_t mask = slots.size() - 1;
+            size_t i = hash(key) & mask;
+            while (slots[i].gen == gen && !slots[i].holds(key))
+                i = (i + 1) & mask;
+            return slots[i];
+        }
+
+        void fill(Slot &slot, const Expr &key, koopa_raw_value_t value)
+        {
+            slot = Slot{key.lhs, key.rhs, key.op, gen, value};
+            if (++count * 2 > slots.size())
+                reserve(count);
+        }
+
+        void rehash(const vector<Slot> &old)
+        {
+            size_t mask = slots.size() - 1;
+            for (const auto &slot : old)
+            {
+                if (slot.gen != gen)
+                    continue;
+                size_t i = hash(Expr{slot.lhs, slot.rhs, slot.op}) & mask;
+                while (slots[i].gen == gen)
+                    i = (i + 1) & mask;
+                slots[i] = slot;
+            }
+        }
+    };
+
+    Table exprs;
+    // value each alloc holds at the current point of the block
+    Table memory;
+    Table repl;
+
+    static bool commutative(koopa_raw_binary_op_t op)
+    {
+        return op == KOOPA_RBO_NOT_EQ || op == KOOPA_RBO_EQ || op == KOOPA_RBO_ADD || op == KOOPA_RBO_MUL ||
+               op == KOOPA_RBO_AND || op == KOOPA_RBO_OR || op == KOOPA_RBO_XOR;
+    }
+
+    // Pointers never have the top bit set, so constants get it to keep
+    // the two apart.
+    static uint64_t number(koopa_raw_value_t value)
+    {
+        if (value->kind.tag == KOOPA_RVT_INTEGER)
+            return 1ull << 63 | static_cast<uint32_t>(value->kind.data.integer.value);
+        return reinterpret_cast<uintptr_t>(value);
+    }
+
+    static Expr value_key(koopa_raw_value_t value)
+    {
+        return Expr{reinterpret_cast<uintptr_t>(value), 0, 0};
+    }
+
+    void resolve(koopa_raw_value_t &op) const
+    {
+        if (repl.empty() || op->kind.tag == KOOPA_RVT_INTEGER)
+            return;
+        while (auto to = repl.find(value_key(op)))
+            op = to;
+    }
+
+    void run(koopa_raw_function_t func)
+    {
+        repl.clear();
+        for (size_t i = 0; i < func->bbs.len; ++i)
+            number_block(const_cast<koopa_raw_basic_block_data_t *>(
+                reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])));
+        if (repl.empty())
+            return;
+
+        // a block may use values of a block laid out after it
+        for (size_t i = 0; i < func->bbs.len; ++i)
+        {
+            auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            for (size_t j = 0; j < bb->insts.len; ++j)
+                for_each_operand(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]),
+                                 [&](koopa_raw_value_t &op)
+                                 { resolve(op); });
+        }
+    }
+
+    void number_block(koopa_raw_basic_block_data_t *bb)
+    {
+        exprs.clear();
+        memory.clear();
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < bb->insts.len; ++i)
+        {
+            auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]);
+            const auto &kind = inst->kind;
+            for_each_operand(inst, [&](koopa_raw_value_t &op)
+                             { resolve(op); });
+            if (kind.tag == KOOPA_RVT_BINARY)
+            {
+                auto op = kind.data.binary.op;
+                Expr key{number(kind.data.binary.lhs), number(kind.data.binary.rhs), static_cast<uint32_t>(op)};
+                if (commutative(op) && key.lhs > key.rhs)
+                    swap(key.lhs, key.rhs);
+                auto res = exprs.insert(key, inst);
+                if (!res.second)
+                {
+                    repl.assign(value_key(inst), res.first);
+                    ++exprs_removed;
+                    continue;
+                }
+            }
+            else if (kind.tag == KOOPA_RVT_LOAD)
+            {
+                auto res = memory.insert(value_key(kind.data.load.src), inst);
+                if (!res.second)
+                {
+                    repl.assign(value_key(inst), res.first);
+                    ++loads_removed;
+                    continue;
+                }
+            }
+            else if (kind.tag == KOOPA_RVT_STORE)
+                memory.assign(value_key(kind.data.store.dest), kind.data.store.value);
+            bb->insts.buffer[kept++] = inst;
+        }
+        bb->insts.len = kept;
+    }
+};
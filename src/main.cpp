@@ -1,52 +1,401 @@
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+#include "arena.h"
 #include "ast.h"
+#include "cache.h"
+#include "context.h"
+#include "dce.h"
+#include "elf_writer.h"
+#include "ir.h"
 #include "koopa.h"
+#include "koopa_bin.h"
+#include "lvn.h"
+#include "mem2reg.h"
+#include "raw_builder.h"
+#include "raw_printer.h"
 #include "rp.h"
+#include "stats.h"
+#include "symtab.h"
 
 using namespace std;
 
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
+typedef void *yyscan_t;
+extern int yylex_init_extra(Interner *symbols, yyscan_t *scanner);
+extern struct yy_buffer_state *yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern int yyparse(yyscan_t scanner, BaseAST *&ast, Arena &arena, Interner &symbols);
 
-int main(int argc, const char *argv[])
+struct Options
+{
+  string mode;
+  bool use_mem2reg = false;
+  bool use_lvn = false;
+  bool use_dce = false;
+  bool use_regalloc = false;
+  bool use_peephole = false;
+  bool time_passes = false;
+  bool print_stats = false;
+  // threads generating the functions of one file
+  int codegen_workers = 1;
+  string cache_dir;
+  size_t cache_mb = 256;
+};
+
+// Everything besides the source that decides the output.
+static string cache_config(const Options &options)
 {
-  assert(argc == 5);
-  auto mode = argv[1];
-  auto input = argv[2];
-  auto output = argv[4];
+  string config = string(compiler_version) + " " + options.mode;
+  if (options.use_mem2reg)
+    config += " -mem2reg";
+  if (options.use_lvn)
+    config += " -lvn";
+  if (options.use_dce)
+    config += " -dce";
+  if (options.use_regalloc)
+    config += " -regalloc";
+  if (options.use_peephole)
+    config += " -peephole";
+  return config;
+}
 
-  yyin = fopen(input, "r");
-  assert(yyin);
+static mutex report_lock;
 
-  unique_ptr<BaseAST> ast;
-  auto ret = yyparse(ast);
-  assert(!ret);
+// Parses the SysY source in ctx into ctx.ast; returns 0 on success.
+static int parse(CompileContext &ctx, const string &input)
+{
+  // the scanner lexes the source in place and identifiers point into it
+  ctx.symbols.borrow_names = true;
+
+  yyscan_t scanner;
+  yylex_init_extra(&ctx.symbols, &scanner);
+  yy_scan_buffer(ctx.source.data(), ctx.source.buffer_size(), scanner);
+  ctx.stats.start("parse");
+  int ret = yyparse(scanner, ctx.ast, ctx.arena, ctx.symbols);
+  ctx.stats.stop();
+  yylex_destroy(scanner);
+  if (ret != 0)
+  {
+    cerr << input << ": parse failed" << endl;
+    return 1;
+  }
+  ctx.stats.count("ast nodes", ctx.arena.object_count());
+  ctx.stats.count("arena bytes", ctx.arena.bytes_used());
+  ctx.stats.count("identifiers", ctx.symbols.size());
+  return 0;
+}
 
-  freopen(output, "w", stdout);
+// Translates the source in ctx, SysY or binary IR, into output; returns 0
+// on success.
+static int translate(const Options &options, CompileContext &ctx, const string &input, const string &output,
+                     Peephole &peephole_stats)
+{
+  ctx.stats.count("source bytes", ctx.source.size());
+  KoopaBinReader reader;
+  koopa_raw_program_t raw;
+  bool from_bin = KoopaBinReader::is_binary(ctx.source.data(), ctx.source.size());
+  if (from_bin)
+  {
+    ctx.stats.start("load");
+    bool ok = reader.read(ctx.source.data(), ctx.source.size(), raw);
+    ctx.stats.stop();
+    if (!ok)
+    {
+      cerr << input << ": malformed binary IR" << endl;
+      return 1;
+    }
+    ctx.stats.count("ir instructions", reader.inst_count());
+  }
+  else if (parse(ctx, input) != 0)
+    return 1;
 
-  if (string(mode).compare(string("-koopa")) == 0)
+  FILE *file = fopen(output.c_str(), "wb");
+  if (file == nullptr)
   {
-    cout << ast->IR_string(nullptr);
+    cerr << "cannot open " << output << endl;
+    return 1;
   }
 
-  if (string(mode).compare(string("-riscv")) == 0)
+  Mem2Reg mem2reg;
+  auto optimize = [&](const koopa_raw_program_t &raw)
   {
-    koopa_program_t program;
-    koopa_error_code_t ret = koopa_parse_from_string(ast->IR_string(nullptr).c_str(), &program);
-    assert(ret == KOOPA_EC_SUCCESS);
-    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-    koopa_delete_program(program);
+    if (options.use_mem2reg)
+    {
+      ctx.stats.start("mem2reg");
+      mem2reg.run(raw);
+      ctx.stats.stop();
+      ctx.stats.count("mem2reg allocs removed", mem2reg.allocs_removed);
+      ctx.stats.count("mem2reg loads removed", mem2reg.loads_removed);
+      ctx.stats.count("mem2reg stores removed", mem2reg.stores_removed);
+      ctx.stats.count("mem2reg block params", mem2reg.params_added);
+    }
+    if (options.use_lvn)
+    {
+      LocalValueNumbering lvn;
+      ctx.stats.start("lvn");
+      lvn.run(raw);
+      ctx.stats.stop();
+      ctx.stats.count("lvn exprs removed", lvn.exprs_removed);
+      ctx.stats.count("lvn loads removed", lvn.loads_removed);
+    }
+    if (options.use_dce)
+    {
+      DeadCodeElimination dce;
+      ctx.stats.start("dce");
+      dce.run(raw);
+      ctx.stats.stop();
+      ctx.stats.count("dce unreachable removed", dce.unreachable_removed);
+      ctx.stats.count("dce blocks removed", dce.blocks_removed);
+      ctx.stats.count("dce insts removed", dce.insts_removed);
+      ctx.stats.count("dce stores removed", dce.stores_removed);
+    }
+  };
+
+  bool raw_passes = options.use_mem2reg || options.use_lvn || options.use_dce;
+  if (options.mode == "-koopa" && !from_bin && !raw_passes)
+  {
+    IRWriter ir;
+    ctx.stats.start("irgen");
+    ctx.ast->gen_IR(ir, ctx.symtab);
+    ctx.stats.stop();
+    ctx.stats.start("write");
+    ir.write(file);
+    ctx.stats.stop();
+    ctx.stats.count("ir instructions", ir.inst_count());
+    fclose(file);
+    return 0;
+  }
+
+  RawBuilder builder;
+  if (!from_bin)
+  {
+    ctx.stats.start("irgen");
+    ctx.ast->gen_IR(builder, ctx.symtab);
+    raw = builder.program();
+    ctx.stats.stop();
+    ctx.stats.count("ir instructions", builder.inst_count());
+  }
+  optimize(raw);
+
+  if (options.mode == "-koopa")
+  {
+    ctx.stats.start("write");
+    RawPrinter(raw).write(file);
+    ctx.stats.stop();
+  }
+  else if (options.mode == "-koopa-bin")
+  {
+    ctx.stats.start("write");
+    KoopaBinWriter bin(raw);
+    bin.write(file);
+    ctx.stats.stop();
+    ctx.stats.count("ir bytes", bin.str().size());
+  }
+  else if (options.mode == "-riscv" || options.mode == "-obj")
+  {
+    RiscvGen codegen(ctx.stats, options.use_regalloc, options.use_peephole, options.codegen_workers);
+    codegen.object = options.mode == "-obj";
+    ctx.stats.start("codegen");
+    codegen.visit(raw);
+    ctx.stats.stop();
+    ctx.stats.start("write");
+    size_t text_bytes = codegen.out.size();
+    if (codegen.object)
+    {
+      ElfWriter elf;
+      uint32_t offset = 0;
+      for (size_t i = 0; i < raw.funcs.len; ++i)
+      {
+        auto func = reinterpret_cast<koopa_raw_function_t>(raw.funcs.buffer[i]);
+        elf.add_function(func->name + 1, offset, codegen.func_sizes[i]);
+        offset += codegen.func_sizes[i];
+      }
+      elf.write(file, codegen.out.take());
+    }
+    else
+      codegen.out.flush(file);
+    ctx.stats.stop();
+    if (codegen.object)
+      ctx.stats.count("text bytes", text_bytes);
+    else
+      ctx.stats.count("asm lines", codegen.out.line_count());
+    peephole_stats = codegen.peephole;
+  }
+  fclose(file);
+  return 0;
+}
 
-    visit(raw);
+// Compiles input into output, through the cache when there is one;
+// returns 0 on success.
+static int compile(const Options &options, CompileCache *cache, const string &input, const string &output,
+                   bool batch)
+{
+  CompileContext ctx;
+  ctx.stats.timing = options.time_passes;
 
-    koopa_delete_raw_program_builder(builder);
+  if (!ctx.source.open(input.c_str()))
+  {
+    cerr << "cannot open " << input << endl;
+    return 1;
+  }
+
+  Peephole peephole_stats;
+  if (cache == nullptr)
+  {
+    if (translate(options, ctx, input, output, peephole_stats) != 0)
+      return 1;
+  }
+  else
+  {
+    string config = cache_config(options);
+    ctx.stats.start("cache");
+    string key = CompileCache::key(ctx.source.data(), ctx.source.size(), config);
+    bool hit = cache->fetch(key, config, ctx.source.data(), ctx.source.size(), output);
+    ctx.stats.stop();
+    ctx.stats.count("cache hits", hit);
+    ctx.stats.count("cache misses", !hit);
+    if (!hit)
+    {
+      if (translate(options, ctx, input, output, peephole_stats) != 0)
+        return 1;
+      ctx.stats.start("cache");
+      cache->store(key, config, ctx.source.data(), ctx.source.size(), output);
+      ctx.stats.stop();
+    }
   }
 
+  if (options.time_passes || options.print_stats)
+  {
+    lock_guard<mutex> guard(report_lock);
+    if (batch)
+      fprintf(stderr, "== %s\n", input.c_str());
+    if (options.time_passes)
+      ctx.stats.print_times(stderr);
+    if (options.print_stats)
+    {
+      ctx.stats.print_counts(stderr);
+      if (options.use_peephole)
+        peephole_stats.print_stats(stderr);
+    }
+  }
   return 0;
 }
+
+// Compiles every "input output" line of the manifest on a pool of workers
+// and prints the throughput. Returns the number of failed files.
+static int compile_batch(const Options &options, CompileCache *cache, const char *manifest, int workers)
+{
+  vector<pair<string, string>> jobs;
+  ifstream list(manifest);
+  if (!list)
+  {
+    cerr << "cannot open " << manifest << endl;
+    return 1;
+  }
+  string line;
+  while (getline(list, line))
+  {
+    istringstream fields(line);
+    string input, output;
+    if (!(fields >> input) || input[0] == '#')
+      continue;
+    if (!(fields >> output))
+    {
+      cerr << manifest << ": missing output for " << input << endl;
+      return 1;
+    }
+    jobs.emplace_back(input, output);
+  }
+
+  auto start = chrono::steady_clock::now();
+  atomic<size_t> next(0);
+  atomic<int> failed(0);
+  vector<thread> pool;
+  for (int w = 0; w < workers; ++w)
+    pool.emplace_back([&]()
+                      {
+      for (size_t i = next++; i < jobs.size(); i = next++)
+        if (compile(options, cache, jobs[i].first, jobs[i].second, true) != 0)
+          ++failed; });
+  for (auto &worker : pool)
+    worker.join();
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  fprintf(stderr, "batch: %zu files, %d failed, %d workers, %.3f s, %.1f files/s\n",
+          jobs.size(), failed.load(), workers, seconds, jobs.size() / seconds);
+  if (cache != nullptr)
+    fprintf(stderr, "cache: %zu hits, %zu misses, %zu evicted\n", cache->hits.load(), cache->misses.load(),
+            cache->evictions.load());
+  return failed;
+}
+
+int main(int argc, const char *argv[])
+{
+  // compiler <mode> <input> -o <output> [options]
+  // compiler <mode> --batch <manifest> [-j <workers>] [options]
+  // <mode> is -koopa, -koopa-bin for the IR in binary, -riscv, or -obj for
+  // an ELF object of the RISC-V code. <input> is SysY source, or binary IR
+  // written by -koopa-bin to run only the later stages.
+  // -j sets the files compiled at once in batch mode, and the threads
+  // generating functions otherwise. --cache <dir> serves output compiled
+  // before from dir, which --cache-size caps at the given megabytes.
+  assert(argc >= 4);
+  Options options;
+  options.mode = argv[1];
+  bool batch = string(argv[2]) == "--batch";
+  int workers = thread::hardware_concurrency();
+  if (!batch)
+    assert(argc >= 5);
+
+  for (int i = batch ? 4 : 5; i < argc; ++i)
+  {
+    if (string(argv[i]).compare(string("-O1")) == 0)
+    {
+      options.use_mem2reg = true;
+      options.use_lvn = true;
+      options.use_dce = true;
+      options.use_regalloc = true;
+      options.use_peephole = true;
+    }
+    else if (string(argv[i]).compare(string("-mem2reg")) == 0)
+      options.use_mem2reg = true;
+    else if (string(argv[i]).compare(string("-lvn")) == 0)
+      options.use_lvn = true;
+    else if (string(argv[i]).compare(string("-dce")) == 0)
+      options.use_dce = true;
+    else if (string(argv[i]).compare(string("--time-passes")) == 0)
+      options.time_passes = true;
+    else if (string(argv[i]).compare(string("--stats")) == 0)
+      options.print_stats = true;
+    else if (string(argv[i]).compare(string("-j")) == 0 && i + 1 < argc)
+      workers = atoi(argv[++i]);
+    else if (string(argv[i]).compare(string("--cache")) == 0 && i + 1 < argc)
+      options.cache_dir = argv[++i];
+    else if (string(argv[i]).compare(string("--cache-size")) == 0 && i + 1 < argc)
+      options.cache_mb = atol(argv[++i]);
+    else
+    {
+      cerr << "unknown option: " << argv[i] << endl;
+      return 1;
+    }
+  }
+
+  workers = workers > 0 ? workers : 1;
+  unique_ptr<CompileCache> cache;
+  if (!options.cache_dir.empty())
+    cache = make_unique<CompileCache>(options.cache_dir, options.cache_mb << 20);
+  if (batch)
+    return compile_batch(options, cache.get(), argv[3], workers) != 0;
+  options.codegen_workers = workers;
+  return compile(options, cache.get(), argv[2], argv[4], false);
+}
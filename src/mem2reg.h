@@ -0,0 +1,360 @@
+#pragma once
+
+#include <cassert>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "koopa.h"
+#include "raw_builder.h"
+
+using namespace std;
+
+// Promotes every alloc that is only loaded from and stored to into SSA
+// values, rewriting a program built by RawBuilder in place. Block
+// parameters stand in for phis: they are placed on the iterated dominance
+// frontier of the stores, where the variable is live, and each branch into
+// such a block passes the value reaching it. A variable read before any
+// store reads 0. The pass owns the new parameter nodes and instruction
+// lists, so it must outlive the program.
+class Mem2Reg
+{
+public:
+    size_t allocs_removed = 0;
+    size_t loads_removed = 0;
+    size_t stores_removed = 0;
+    size_t params_added = 0;
+
+    void run(const koopa_raw_program_t &program)
+    {
+        for (size_t i = 0; i < program.funcs.len; ++i)
+            run(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]));
+    }
+
+private:
+    NodePool<koopa_raw_value_data_t> values;
+    deque<vector<const void *>> lists;
+    koopa_raw_value_data_t *zero = nullptr;
+
+    // variable index of each promotable alloc
+    unordered_map<koopa_raw_value_t, int> var;
+    // (variable, parameter) pairs added to each block, in parameter order
+    vector<vector<pair<int, koopa_raw_value_t>>> block_params;
+    unordered_map<koopa_raw_value_t, koopa_raw_value_t> repl;
+
+    static bool is_i32_alloc(koopa_raw_value_t inst)
+    {
+        return inst->kind.tag == KOOPA_RVT_ALLOC && inst->ty->tag == KOOPA_RTT_POINTER &&
+               inst->ty->data.pointer.base->tag == KOOPA_RTT_INT32;
+    }
+
+    static koopa_raw_value_t inst_at(koopa_raw_basic_block_t bb, size_t i)
+    {
+        return reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]);
+    }
+
+    int var_of(koopa_raw_value_t ptr) const
+    {
+        auto it = var.find(ptr);
+        return it == var.end() ? -1 : it->second;
+    }
+
+    koopa_raw_value_t zero_value()
+    {
+        if (zero == nullptr)
+        {
+            zero = &values.alloc();
+            zero->ty = &raw_i32_type;
+            zero->name = nullptr;
+            zero->used_by = koopa_raw_slice_t{nullptr, 0, KOOPA_RSIK_VALUE};
+            zero->kind.tag = KOOPA_RVT_INTEGER;
+            zero->kind.data.integer.value = 0;
+        }
+        return zero;
+    }
+
+    koopa_raw_slice_t make_slice(vector<const void *> items)
+    {
+        auto &list = lists.emplace_back(move(items));
+        return koopa_raw_slice_t{list.data(), static_cast<uint32_t>(list.size()), KOOPA_RSIK_VALUE};
+    }
+
+    void run(koopa_raw_function_t func)
+    {
+        CFG cfg(func);
+        size_t n = cfg.size();
+        if (n == 0)
+            return;
+
+        find_promotable(cfg);
+        if (var.empty())
+            return;
+        vector<int> idom = cfg.dominators();
+        place_params(cfg, idom);
+        rename(cfg, idom);
+    }
+
+    void find_promotable(const CFG &cfg)
+    {
+        var.clear();
+        for (auto bb : cfg.bbs)
+            for (size_t i = 0; i < bb->insts.len; ++i)
+                if (is_i32_alloc(inst_at(bb, i)))
+                    var.emplace(inst_at(bb, i), 0);
+
+        // an alloc used other than as a load or store address escapes
+        for (auto bb : cfg.bbs)
+            for (size_t i = 0; i < bb->insts.len; ++i)
+            {
+                auto inst = inst_at(bb, i);
+                const auto &kind = inst->kind;
+                for_each_operand(inst, [&](koopa_raw_value_t &op)
+                                 {
+                    bool address = (kind.tag == KOOPA_RVT_LOAD && &op == &kind.data.load.src) ||
+                                   (kind.tag == KOOPA_RVT_STORE && &op == &kind.data.store.dest);
+                    if (!address)
+                        var.erase(op); });
+            }
+
+        // number the survivors in program order
+        int num = 0;
+        for (auto bb : cfg.bbs)
+            for (size_t i = 0; i < bb->insts.len; ++i)
+            {
+                auto it = var.find(inst_at(bb, i));
+                if (it != var.end())
+                    it->second = num++;
+            }
+    }
+
+    void place_params(const CFG &cfg, const vector<int> &idom)
+    {
+        size_t n = cfg.size();
+        size_t num_vars = var.size();
+
+        vector<vector<size_t>> frontier(n);
+        for (size_t b = 0; b < n; ++b)
+        {
+            if (cfg.pred[b].size() < 2 || idom[b] < 0)
+                continue;
+            for (auto p : cfg.pred[b])
+                for (int runner = p; idom[runner] >= 0 && runner != idom[b]; runner = idom[runner])
+                {
+                    if (frontier[runner].empty() || frontier[runner].back() != b)
+                        frontier[runner].push_back(b);
+                    if (runner == 0)
+                        break;
+                }
+        }
+
+        // blocks storing each variable, and blocks reading it before any
+        // store of their own
+        vector<vector<size_t>> def_blocks(num_vars), use_blocks(num_vars);
+        vector<int> last_def(num_vars, -1), last_use(num_vars, -1);
+        for (size_t b = 0; b < n; ++b)
+        {
+            auto bb = cfg.bbs[b];
+            for (size_t i = 0; i < bb->insts.len; ++i)
+            {
+                auto inst = inst_at(bb, i);
+                if (inst->kind.tag == KOOPA_RVT_STORE)
+                {
+                    int v = var_of(inst->kind.data.store.dest);
+                    if (v >= 0 && last_def[v] != static_cast<int>(b))
+                    {
+                        last_def[v] = b;
+                        def_blocks[v].push_back(b);
+                    }
+                }
+                else if (inst->kind.tag == KOOPA_RVT_LOAD)
+                {
+                    int v = var_of(inst->kind.data.load.src);
+                    if (v >= 0 && last_def[v] != static_cast<int>(b) && last_use[v] != static_cast<int>(b))
+                    {
+                        last_use[v] = b;
+                        use_blocks[v].push_back(b);
+                    }
+                }
+            }
+        }
+
+        block_params.assign(n, {});
+        vector<int> defines(n, -1), live(n, -1), placed(n, -1), queued(n, -1);
+        vector<size_t> work;
+        for (size_t v = 0; v < num_vars; ++v)
+        {
+            // a variable no block reads before storing it needs no params
+            if (use_blocks[v].empty())
+                continue;
+
+            // blocks where v is live on entry
+            for (auto b : def_blocks[v])
+                defines[b] = v;
+            work = use_blocks[v];
+            for (auto b : work)
+                live[b] = v;
+            while (!work.empty())
+            {
+                size_t b = work.back();
+                work.pop_back();
+                for (auto p : cfg.pred[b])
+                    if (live[p] != static_cast<int>(v) && defines[p] != static_cast<int>(v))
+                    {
+                        live[p] = v;
+                        work.push_back(p);
+                    }
+            }
+
+            work = def_blocks[v];
+            for (auto b : work)
+                queued[b] = v;
+            while (!work.empty())
+            {
+                size_t b = work.back();
+                work.pop_back();
+                for (auto d : frontier[b])
+                {
+                    if (placed[d] == static_cast<int>(v) || live[d] != static_cast<int>(v))
+                        continue;
+                    placed[d] = v;
+                    block_params[d].emplace_back(v, nullptr);
+                    if (queued[d] != static_cast<int>(v))
+                    {
+                        queued[d] = v;
+                        work.push_back(d);
+                    }
+                }
+            }
+        }
+
+        for (size_t b = 0; b < n; ++b)
+        {
+            if (block_params[b].empty())
+                continue;
+            vector<const void *> params;
+            for (auto &param : block_params[b])
+            {
+                auto &value = values.alloc();
+                value.ty = &raw_i32_type;
+                value.name = nullptr;
+                value.used_by = koopa_raw_slice_t{nullptr, 0, KOOPA_RSIK_VALUE};
+                value.kind.tag = KOOPA_RVT_BLOCK_ARG_REF;
+                value.kind.data.block_arg_ref.index = params.size();
+                param.second = &value;
+                params.push_back(&value);
+            }
+            params_added += params.size();
+            const_cast<koopa_raw_basic_block_data_t *>(cfg.bbs[b])->params = make_slice(move(params));
+        }
+    }
+
+    // Walks the dominator tree with the value of every variable at the
+    // current point, undoing a block's assignments when leaving it.
+    void rename(const CFG &cfg, const vector<int> &idom)
+    {
+        size_t n = cfg.size();
+        vector<vector<size_t>> children(n);
+        vector<size_t> roots{0};
+        for (size_t b = 1; b < n; ++b)
+        {
+            if (idom[b] >= 0)
+                children[idom[b]].push_back(b);
+            else
+                roots.push_back(b); // unreachable: starts from nothing
+        }
+
+        repl.clear();
+        vector<koopa_raw_value_t> cur(var.size(), nullptr);
+        vector<pair<int, koopa_raw_value_t>> undo;
+        // (block, undo mark); a block is entered when pushed with mark -1
+        vector<pair<size_t, long>> stack;
+        for (auto root : roots)
+        {
+            fill(cur.begin(), cur.end(), nullptr);
+            stack.push_back({root, -1});
+            while (!stack.empty())
+            {
+                auto &top = stack.back();
+                if (top.second >= 0)
+                {
+                    while (undo.size() > static_cast<size_t>(top.second))
+                    {
+                        cur[undo.back().first] = undo.back().second;
+                        undo.pop_back();
+                    }
+                    stack.pop_back();
+                    continue;
+                }
+                size_t b = top.first;
+                top.second = undo.size();
+                auto set = [&](int v, koopa_raw_value_t value)
+                {
+                    undo.emplace_back(v, cur[v]);
+                    cur[v] = value;
+                };
+                for (auto &param : block_params[b])
+                    set(param.first, param.second);
+                rewrite_block(cfg, cfg.bbs[b], cur, set);
+                for (auto c : children[b])
+                    stack.push_back({c, -1});
+            }
+        }
+    }
+
+    template <typename Set>
+    void rewrite_block(const CFG &cfg, koopa_raw_basic_block_t bb, const vector<koopa_raw_value_t> &cur, Set set)
+    {
+        auto value_of = [&](int v)
+        {
+            return cur[v] != nullptr ? cur[v] : zero_value();
+        };
+        auto resolve = [&](koopa_raw_value_t &op)
+        {
+            auto it = repl.find(op);
+            if (it != repl.end())
+                op = it->second;
+        };
+        auto edge_args = [&](koopa_raw_basic_block_t target)
+        {
+            vector<const void *> args;
+            for (auto &param : block_params[cfg.index.at(target)])
+                args.push_back(value_of(param.first));
+            return make_slice(move(args));
+        };
+
+        vector<const void *> kept;
+        for (size_t i = 0; i < bb->insts.len; ++i)
+        {
+            auto inst = inst_at(bb, i);
+            auto &kind = const_cast<koopa_raw_value_data_t *>(inst)->kind;
+            if (kind.tag == KOOPA_RVT_ALLOC && var_of(inst) >= 0)
+            {
+                ++allocs_removed;
+                continue;
+            }
+            if (kind.tag == KOOPA_RVT_LOAD && var_of(kind.data.load.src) >= 0)
+            {
+                repl[inst] = value_of(var_of(kind.data.load.src));
+                ++loads_removed;
+                continue;
+            }
+            for_each_operand(inst, resolve);
+            if (kind.tag == KOOPA_RVT_STORE && var_of(kind.data.store.dest) >= 0)
+            {
+                set(var_of(kind.data.store.dest), kind.data.store.value);
+                ++stores_removed;
+                continue;
+            }
+            if (kind.tag == KOOPA_RVT_BRANCH)
+            {
+                kind.data.branch.true_args = edge_args(kind.data.branch.true_bb);
+                kind.data.branch.false_args = edge_args(kind.data.branch.false_bb);
+            }
+            else if (kind.tag == KOOPA_RVT_JUMP)
+                kind.data.jump.args = edge_args(kind.data.jump.target);
+            kept.push_back(inst);
+        }
+        const_cast<koopa_raw_basic_block_data_t *>(bb)->insts = make_slice(move(kept));
+    }
+};
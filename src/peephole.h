@@ -0,0 +1,321 @@
+#pragma once
+
+#include <cstdio>
+#include <unordered_set>
+#include <vector>
+#include "asm.h"
+
+using namespace std;
+
+// Peephole optimizer over the instruction list of one function. Each rule
+// looks at the instruction at position i and a few of its neighbours in
+// the same straight-line sequence, and either deletes instructions (they
+// become NOP until the list is compacted) or rewrites them into cheaper
+// ones. Rules are applied until none of them fires.
+class Peephole
+{
+public:
+    void run(vector<AsmInst> &code)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            loaded_slots.clear();
+            for (const auto &inst : code)
+                if (inst.op == AsmOp::LW && inst.rs1 == Reg::sp)
+                    loaded_slots.insert(inst.imm);
+
+            for (size_t i = 0; i < code.size(); ++i)
+                for (cur_rule = 0; cur_rule < num_rules && code[i].op != AsmOp::NOP; ++cur_rule)
+                    if ((this->*rules[cur_rule].apply)(code, i))
+                    {
+                        ++stats[cur_rule].applied;
+                        changed = true;
+                    }
+        }
+
+        size_t n = 0;
+        for (const auto &inst : code)
+            if (inst.op != AsmOp::NOP)
+                code[n++] = inst;
+        stats[num_rules].removed += code.size() - n;
+        code.resize(n);
+    }
+
+    // Adds the counts of a pass that ran on other functions.
+    void merge(const Peephole &other)
+    {
+        for (size_t r = 0; r <= num_rules; ++r)
+        {
+            stats[r].applied += other.stats[r].applied;
+            stats[r].removed += other.stats[r].removed;
+        }
+    }
+
+    void print_stats(FILE *fp) const
+    {
+        for (size_t r = 0; r < num_rules; ++r)
+            fprintf(fp, "peephole: %-14s applied %6zu, removed %6zu\n",
+                    rules[r].name, stats[r].applied, stats[r].removed);
+        fprintf(fp, "peephole: %-14s removed %6zu\n", "total", stats[num_rules].removed);
+    }
+
+private:
+    struct Rule
+    {
+        const char *name;
+        bool (Peephole::*apply)(vector<AsmInst> &code, size_t i);
+    };
+
+    struct Stats
+    {
+        size_t applied = 0;
+        size_t removed = 0;
+    };
+
+    static constexpr size_t num_rules = 7;
+    // how far a rule looks back or ahead from the instruction it rewrites
+    static constexpr size_t window = 64;
+    static const Rule rules[num_rules];
+
+    Stats stats[num_rules + 1];
+    size_t cur_rule;
+    unordered_set<int> loaded_slots;
+    vector<size_t> users;
+
+    void remove(AsmInst &inst)
+    {
+        inst.op = AsmOp::NOP;
+        ++stats[cur_rule].removed;
+    }
+
+    static size_t next(const vector<AsmInst> &code, size_t i)
+    {
+        do
+            ++i;
+        while (i < code.size() && code[i].op == AsmOp::NOP);
+        return i;
+    }
+
+    // Rewrites every read of r after position i into a read of with, as
+    // long as all of them sit in the same straight-line sequence and r is
+    // dead afterwards. Fails without changing anything otherwise.
+    bool replace_uses(vector<AsmInst> &code, size_t i, Reg r, Reg with)
+    {
+        users.clear();
+        bool with_clobbered = false;
+        bool dead = false;
+        for (size_t k = next(code, i); k < code.size() && !dead; k = next(code, k))
+        {
+            if (k - i > window)
+                return false;
+            const auto &inst = code[k];
+            if (inst.reads(r))
+            {
+                if (inst.op == AsmOp::RET || with_clobbered)
+                    return false;
+                users.push_back(k);
+            }
+            if (inst.def() == r || inst.op == AsmOp::RET)
+                dead = true;
+            else if (inst.def() == with)
+                with_clobbered = true;
+            else if (inst.ends_sequence())
+            {
+                if (!is_scratch(r))
+                    return false;
+                dead = true;
+            }
+        }
+        if (!dead && !is_scratch(r))
+            return false;
+        for (auto k : users)
+        {
+            if (code[k].rs1 == r)
+                code[k].rs1 = with;
+            if (code[k].rs2 == r)
+                code[k].rs2 = with;
+        }
+        return true;
+    }
+
+    // j L immediately followed by L:
+    bool jump_to_next(vector<AsmInst> &code, size_t i)
+    {
+        if (code[i].op != AsmOp::J)
+            return false;
+        size_t k = next(code, i);
+        if (k == code.size() || code[k].op != AsmOp::LABEL || code[k].imm != code[i].imm)
+            return false;
+        remove(code[i]);
+        return true;
+    }
+
+    // add x, y, zero / addi x, y, 0 and friends become mv x, y, and
+    // vanish when x == y
+    bool identity(vector<AsmInst> &code, size_t i)
+    {
+        auto &inst = code[i];
+        Reg src = Reg::none;
+        switch (inst.op)
+        {
+        case AsmOp::ADD:
+        case AsmOp::OR:
+        case AsmOp::XOR:
+            if (inst.rs2 == Reg::zero)
+                src = inst.rs1;
+            else if (inst.rs1 == Reg::zero)
+                src = inst.rs2;
+            break;
+
+        case AsmOp::SUB:
+        case AsmOp::SLL:
+        case AsmOp::SRL:
+        case AsmOp::SRA:
+            if (inst.rs2 == Reg::zero)
+                src = inst.rs1;
+            break;
+
+        case AsmOp::ADDI:
+        case AsmOp::ORI:
+        case AsmOp::XORI:
+        case AsmOp::SLLI:
+        case AsmOp::SRLI:
+        case AsmOp::SRAI:
+            if (inst.imm == 0)
+                src = inst.rs1;
+            break;
+
+        default:
+            break;
+        }
+        if (src == Reg::none)
+            return false;
+        if (src == inst.rd)
+            remove(inst);
+        else
+            inst = make_inst(AsmOp::MV, inst.rd, src);
+        return true;
+    }
+
+    // mv x, x, and mv x, y when an earlier mv already made x == y
+    bool redundant_move(vector<AsmInst> &code, size_t i)
+    {
+        const auto &inst = code[i];
+        if (inst.op != AsmOp::MV)
+            return false;
+        if (inst.rd == inst.rs1)
+        {
+            remove(code[i]);
+            return true;
+        }
+        for (size_t k = i; k-- > 0 && i - k <= window;)
+        {
+            const auto &prev = code[k];
+            if (prev.op == AsmOp::NOP)
+                continue;
+            if (prev.op == AsmOp::MV &&
+                ((prev.rd == inst.rd && prev.rs1 == inst.rs1) || (prev.rd == inst.rs1 && prev.rs1 == inst.rd)))
+            {
+                remove(code[i]);
+                return true;
+            }
+            if (prev.ends_sequence() || prev.def() == inst.rd || prev.def() == inst.rs1)
+                return false;
+        }
+        return false;
+    }
+
+    // sw r, off(sp) or lw r, off(sp) followed by lw x, off(sp): the value
+    // is still in r
+    bool store_reload(vector<AsmInst> &code, size_t i)
+    {
+        auto &inst = code[i];
+        if (inst.op != AsmOp::LW || inst.rs1 != Reg::sp)
+            return false;
+        for (size_t k = i; k-- > 0 && i - k <= window;)
+        {
+            const auto &prev = code[k];
+            if (prev.op == AsmOp::NOP)
+                continue;
+            if (prev.ends_sequence() || prev.def() == Reg::sp)
+                return false;
+            if ((prev.op == AsmOp::SW || prev.op == AsmOp::LW) && prev.rs1 == Reg::sp && prev.imm == inst.imm)
+            {
+                Reg r = prev.op == AsmOp::SW ? prev.rs2 : prev.rd;
+                for (size_t j = k + 1; j < i; ++j)
+                    if (code[j].op != AsmOp::NOP && code[j].def() == r)
+                        return false;
+                if (r == inst.rd)
+                    remove(inst);
+                else
+                    inst = make_inst(AsmOp::MV, inst.rd, r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // stores to a slot no instruction ever loads, or that is stored to
+    // again before being loaded
+    bool dead_store(vector<AsmInst> &code, size_t i)
+    {
+        const auto &inst = code[i];
+        if (inst.op != AsmOp::SW || inst.rs1 != Reg::sp)
+            return false;
+        if (loaded_slots.count(inst.imm) == 0)
+        {
+            remove(code[i]);
+            return true;
+        }
+        for (size_t k = next(code, i); k < code.size() && k - i <= window; k = next(code, k))
+        {
+            const auto &later = code[k];
+            if (later.ends_sequence() || later.def() == Reg::sp)
+                return false;
+            if (later.rs1 == Reg::sp && later.imm == inst.imm)
+            {
+                if (later.op != AsmOp::SW)
+                    return false;
+                remove(code[i]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // li x, 0 feeding later instructions: read zero instead
+    bool zero_reg(vector<AsmInst> &code, size_t i)
+    {
+        const auto &inst = code[i];
+        if (inst.op != AsmOp::LI || inst.imm != 0)
+            return false;
+        if (!replace_uses(code, i, inst.rd, Reg::zero))
+            return false;
+        remove(code[i]);
+        return true;
+    }
+
+    // mv x, y whose copy is dead after its last reader: read y directly
+    bool copy_forward(vector<AsmInst> &code, size_t i)
+    {
+        const auto &inst = code[i];
+        if (inst.op != AsmOp::MV || inst.rd == Reg::sp)
+            return false;
+        if (!replace_uses(code, i, inst.rd, inst.rs1))
+            return false;
+        remove(code[i]);
+        return true;
+    }
+};
+
+inline const Peephole::Rule Peephole::rules[Peephole::num_rules] = {
+    {"jump_to_next", &Peephole::jump_to_next},
+    {"identity", &Peephole::identity},
+    {"redundant_move", &Peephole::redundant_move},
+    {"store_reload", &Peephole::store_reload},
+    {"dead_store", &Peephole::dead_store},
+    {"zero_reg", &Peephole::zero_reg},
+    {"copy_forward", &Peephole::copy_forward},
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cassert>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ir.h"
+#include "koopa.h"
+
+using namespace std;
+
+static const koopa_raw_type_kind_t raw_i32_type = {KOOPA_RTT_INT32, {}};
+static const koopa_raw_type_kind_t raw_unit_type = {KOOPA_RTT_UNIT, {}};
+
+// Hands out value nodes from large chunks; a deque would allocate every
+// few nodes since they are nearly 100 bytes each.
+template <typename T, size_t chunk_size = 4096>
+class NodePool
+{
+public:
+    T &alloc()
+    {
+        if (used == chunk_size)
+        {
+            chunks.emplace_back(new T[chunk_size]());
+            used = 0;
+        }
+        return chunks.back()[used++];
+    }
+
+private:
+    vector<unique_ptr<T[]>> chunks;
+    size_t used = chunk_size;
+};
+
+// Builds a koopa_raw_program_t straight from the AST, so -riscv skips
+// printing and re-parsing its own IR; the time that saves over libkoopa's
+// parser has not been measured. The shape matches what
+// koopa_build_raw_program produces except for used_by, which is left empty:
+// nothing downstream walks uses, and the passes that rewrite the program in
+// place would leave it stale. The builder owns every node and must outlive
+// the program.
+class RawBuilder : public IRBuilder
+{
+public:
+    RawBuilder()
+    {
+        i32_ptr_type.tag = KOOPA_RTT_POINTER;
+        i32_ptr_type.data.pointer.base = &raw_i32_type;
+        func_type.tag = KOOPA_RTT_FUNCTION;
+        func_type.data.function.params = empty_slice(KOOPA_RSIK_TYPE);
+        func_type.data.function.ret = &raw_i32_type;
+    }
+
+    void func_begin(const string &ident) override
+    {
+        auto &func = funcs.emplace_back();
+        func.ty = &func_type;
+        func.name = intern("@" + ident);
+        func.params = empty_slice(KOOPA_RSIK_VALUE);
+        func_bbs.emplace_back();
+        func_list.push_back(&func);
+    }
+
+    void func_end() override
+    {
+        auto &func = funcs.back();
+        func.bbs = make_slice(func_bbs.back(), KOOPA_RSIK_BASIC_BLOCK);
+    }
+
+    Block new_block(const char *prefix) override
+    {
+        auto &bb = bbs.emplace_back();
+        bb.name = intern(block_name(prefix));
+        bb.params = empty_slice(KOOPA_RSIK_VALUE);
+        bb.used_by = empty_slice(KOOPA_RSIK_VALUE);
+        bb_insts.emplace_back();
+        return Block{static_cast<int>(bbs.size()) - 1};
+    }
+
+    void set_block(Block bb) override
+    {
+        func_bbs.back().push_back(&bbs[bb.id]);
+        cur_bb = bb.id;
+    }
+
+    Operand alloc() override
+    {
+        auto value = new_inst(&i32_ptr_type, KOOPA_RVT_ALLOC);
+        return name(value);
+    }
+
+    Operand load(Operand src) override
+    {
+        auto value = new_inst(&raw_i32_type, KOOPA_RVT_LOAD);
+        value->kind.data.load.src = get(src);
+        return name(value);
+    }
+
+    void store(Operand value, Operand dest) override
+    {
+        auto inst = new_inst(&raw_unit_type, KOOPA_RVT_STORE);
+        inst->kind.data.store.value = get(value);
+        inst->kind.data.store.dest = get(dest);
+    }
+
+    Operand binary(koopa_raw_binary_op_t op, Operand lhs, Operand rhs) override
+    {
+        auto value = new_inst(&raw_i32_type, KOOPA_RVT_BINARY);
+        value->kind.data.binary.op = op;
+        value->kind.data.binary.lhs = get(lhs);
+        value->kind.data.binary.rhs = get(rhs);
+        return name(value);
+    }
+
+    void br(Operand cond, Block true_bb, Block false_bb) override
+    {
+        auto inst = new_inst(&raw_unit_type, KOOPA_RVT_BRANCH);
+        inst->kind.data.branch.cond = get(cond);
+        inst->kind.data.branch.true_bb = &bbs[true_bb.id];
+        inst->kind.data.branch.false_bb = &bbs[false_bb.id];
+        inst->kind.data.branch.true_args = empty_slice(KOOPA_RSIK_VALUE);
+        inst->kind.data.branch.false_args = empty_slice(KOOPA_RSIK_VALUE);
+    }
+
+    void jump(Block target) override
+    {
+        auto inst = new_inst(&raw_unit_type, KOOPA_RVT_JUMP);
+        inst->kind.data.jump.target = &bbs[target.id];
+        inst->kind.data.jump.args = empty_slice(KOOPA_RSIK_VALUE);
+    }
+
+    void ret(Operand value) override
+    {
+        auto inst = new_inst(&raw_unit_type, KOOPA_RVT_RETURN);
+        inst->kind.data.ret.value = get(value);
+    }
+
+    koopa_raw_program_t program()
+    {
+        for (size_t i = 0; i < bbs.size(); ++i)
+            bbs[i].insts = make_slice(bb_insts[i], KOOPA_RSIK_VALUE);
+        koopa_raw_program_t raw;
+        raw.values = empty_slice(KOOPA_RSIK_VALUE);
+        raw.funcs = make_slice(func_list, KOOPA_RSIK_FUNCTION);
+        return raw;
+    }
+
+private:
+    koopa_raw_type_kind_t i32_ptr_type;
+    koopa_raw_type_kind_t func_type;
+
+    // deques keep element addresses stable as the program grows
+    NodePool<koopa_raw_value_data_t> values;
+    deque<koopa_raw_basic_block_data_t> bbs;
+    deque<vector<const void *>> bb_insts;
+    deque<koopa_raw_function_data_t> funcs;
+    deque<vector<const void *>> func_bbs;
+    vector<const void *> func_list;
+    int cur_bb = -1;
+    deque<string> names;
+    vector<koopa_raw_value_t> named;
+    unordered_map<int, koopa_raw_value_t> integers;
+
+    static koopa_raw_slice_t empty_slice(koopa_raw_slice_item_kind_t kind)
+    {
+        return koopa_raw_slice_t{nullptr, 0, kind};
+    }
+
+    static koopa_raw_slice_t make_slice(vector<const void *> &items, koopa_raw_slice_item_kind_t kind)
+    {
+        return koopa_raw_slice_t{items.data(), static_cast<uint32_t>(items.size()), kind};
+    }
+
+    const char *intern(string s)
+    {
+        return names.emplace_back(move(s)).c_str();
+    }
+
+    koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag)
+    {
+        auto &value = values.alloc();
+        value.ty = ty;
+        value.name = nullptr;
+        value.used_by = empty_slice(KOOPA_RSIK_VALUE);
+        value.kind.tag = tag;
+        return &value;
+    }
+
+    koopa_raw_value_data_t *new_inst(koopa_raw_type_t ty, koopa_raw_value_tag_t tag)
+    {
+        auto value = new_value(ty, tag);
+        bb_insts[cur_bb].push_back(value);
+        ++insts;
+        return value;
+    }
+
+    Operand name(koopa_raw_value_t value)
+    {
+        named.push_back(value);
+        return Operand::named(named.size() - 1);
+    }
+
+    koopa_raw_value_t get(Operand x)
+    {
+        if (!x.imm)
+            return named[x.value];
+        // integer values are not instructions, so one node per constant
+        // can be shared by every use
+        auto &value = integers[x.value];
+        if (value == nullptr)
+        {
+            auto integer = new_value(&raw_i32_type, KOOPA_RVT_INTEGER);
+            integer->kind.data.integer.value = x.value;
+            value = integer;
+        }
+        return value;
+    }
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cassert>
+#include <charconv>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include "ir.h"
+#include "koopa.h"
+
+using namespace std;
+
+// Prints a raw program as Koopa IR text in the same layout IRWriter uses,
+// for output that passes have rewritten after it was built. Values are
+// numbered afresh in program order.
+class RawPrinter
+{
+public:
+    explicit RawPrinter(const koopa_raw_program_t &program)
+    {
+        buf.reserve(1 << 16);
+        for (size_t i = 0; i < program.funcs.len; ++i)
+            print(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]));
+    }
+
+    const string &str() const
+    {
+        return buf;
+    }
+
+    void write(FILE *out) const
+    {
+        fwrite(buf.data(), 1, buf.size(), out);
+    }
+
+private:
+    string buf;
+    unordered_map<koopa_raw_value_t, int> names;
+
+    RawPrinter &operator<<(const char *s)
+    {
+        buf.append(s);
+        return *this;
+    }
+
+    RawPrinter &operator<<(int x)
+    {
+        char tmp[16];
+        auto res = to_chars(tmp, tmp + sizeof(tmp), x);
+        buf.append(tmp, res.ptr);
+        return *this;
+    }
+
+    RawPrinter &operator<<(koopa_raw_value_t value)
+    {
+        if (value->kind.tag == KOOPA_RVT_INTEGER)
+            return *this << value->kind.data.integer.value;
+        buf += '%';
+        return *this << names.at(value);
+    }
+
+    void define(koopa_raw_value_t value)
+    {
+        int id = static_cast<int>(names.size());
+        names[value] = id;
+        *this << value;
+    }
+
+    void print_target(koopa_raw_basic_block_t bb, const koopa_raw_slice_t &args)
+    {
+        *this << bb->name;
+        if (args.len == 0)
+            return;
+        for (size_t i = 0; i < args.len; ++i)
+            *this << (i == 0 ? "(" : ", ") << reinterpret_cast<koopa_raw_value_t>(args.buffer[i]);
+        *this << ")";
+    }
+
+    void print(koopa_raw_function_t func)
+    {
+        names.clear();
+        *this << "fun " << func->name << "(): i32\n{\n";
+        for (size_t i = 0; i < func->bbs.len; ++i)
+        {
+            auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            *this << bb->name;
+            for (size_t j = 0; j < bb->params.len; ++j)
+            {
+                *this << (j == 0 ? "(" : ", ");
+                define(reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j]));
+                *this << ": i32";
+            }
+            *this << (bb->params.len != 0 ? "):\n" : ":\n");
+            for (size_t j = 0; j < bb->insts.len; ++j)
+                print(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]));
+        }
+        *this << "}\n";
+    }
+
+    void print(koopa_raw_value_t inst)
+    {
+        const auto &kind = inst->kind;
+        switch (kind.tag)
+        {
+        case KOOPA_RVT_ALLOC:
+            define(inst);
+            *this << " = alloc i32\n";
+            break;
+
+        case KOOPA_RVT_LOAD:
+            define(inst);
+            *this << " = load " << kind.data.load.src << "\n";
+            break;
+
+        case KOOPA_RVT_STORE:
+            *this << "store " << kind.data.store.value << ", " << kind.data.store.dest << "\n";
+            break;
+
+        case KOOPA_RVT_BINARY:
+            define(inst);
+            *this << " = " << binary_op_name[kind.data.binary.op] << " " << kind.data.binary.lhs << ", "
+                  << kind.data.binary.rhs << "\n";
+            break;
+
+        case KOOPA_RVT_BRANCH:
+            *this << "br " << kind.data.branch.cond << ", ";
+            print_target(kind.data.branch.true_bb, kind.data.branch.true_args);
+            *this << ", ";
+            print_target(kind.data.branch.false_bb, kind.data.branch.false_args);
+            *this << "\n";
+            break;
+
+        case KOOPA_RVT_JUMP:
+            *this << "jump ";
+            print_target(kind.data.jump.target, kind.data.jump.args);
+            *this << "\n";
+            break;
+
+        case KOOPA_RVT_RETURN:
+            *this << "ret " << kind.data.ret.value << "\n";
+            break;
+
+        default:
+            assert(false);
+        }
+    }
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "asm.h"
+#include "cfg.h"
+#include "koopa.h"
+
+using namespace std;
+
+// Registers handed out by the allocator, caller-saved first so that small
+// functions never touch s*. t0-t3 are kept free as scratch registers for
+// immediates, spilled operands and spilled results.
+static const Reg alloc_regs[] = {
+    Reg::t4, Reg::t5, Reg::t6,
+    Reg::a0, Reg::a1, Reg::a2, Reg::a3, Reg::a4, Reg::a5, Reg::a6, Reg::a7,
+    Reg::s0, Reg::s1, Reg::s2, Reg::s3, Reg::s4, Reg::s5, Reg::s6, Reg::s7, Reg::s8, Reg::s9, Reg::s10, Reg::s11};
+static const int num_alloc_regs = sizeof(alloc_regs) / sizeof(alloc_regs[0]);
+static const int first_callee_saved = 11;
+
+// Whether value is computed into a register, as opposed to an immediate,
+// a stack object created by alloc, or an instruction without a result.
+static bool needs_reg(const koopa_raw_value_t &value)
+{
+    switch (value->kind.tag)
+    {
+    case KOOPA_RVT_INTEGER:
+    case KOOPA_RVT_ALLOC:
+        return false;
+
+    default:
+        return value->ty->tag != KOOPA_RTT_UNIT;
+    }
+}
+
+// Appends the operands of inst that live in registers.
+static void reg_operands(const koopa_raw_value_t &inst, vector<koopa_raw_value_t> &ops)
+{
+    auto add = [&ops](koopa_raw_value_t value)
+    {
+        if (value != nullptr && needs_reg(value))
+            ops.push_back(value);
+    };
+    auto add_all = [&add](const koopa_raw_slice_t &args)
+    {
+        for (size_t i = 0; i < args.len; ++i)
+            add(reinterpret_cast<koopa_raw_value_t>(args.buffer[i]));
+    };
+    const auto &kind = inst->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_BINARY:
+        add(kind.data.binary.lhs);
+        add(kind.data.binary.rhs);
+        break;
+
+    case KOOPA_RVT_LOAD:
+        add(kind.data.load.src);
+        break;
+
+    case KOOPA_RVT_STORE:
+        add(kind.data.store.value);
+        add(kind.data.store.dest);
+        break;
+
+    case KOOPA_RVT_BRANCH:
+        add(kind.data.branch.cond);
+        add_all(kind.data.branch.true_args);
+        add_all(kind.data.branch.false_args);
+        break;
+
+    case KOOPA_RVT_JUMP:
+        add_all(kind.data.jump.args);
+        break;
+
+    case KOOPA_RVT_RETURN:
+        add(kind.data.ret.value);
+        break;
+
+    default:
+        break;
+    }
+}
+
+struct LiveInterval
+{
+    koopa_raw_value_t value;
+    int start;
+    int end;
+};
+
+// Linear-scan register allocation (Poletto & Sarkar) over one function.
+// Instructions are numbered in block order and each value gets a single
+// interval covering every point where block-level liveness says it is
+// live. Block parameters are defined on entry to their block and written
+// by the branches into it, so their intervals cover those branches too.
+// Values left out of reg are spilled to a stack slot, and spilled values
+// whose intervals do not overlap share one, found by the same scan with
+// as many slots as it needs.
+class LinearScan
+{
+public:
+    unordered_map<koopa_raw_value_t, int> reg;
+    vector<int> used_callee_saved;
+    unordered_map<koopa_raw_value_t, int> slot;
+    int num_slots = 0;
+
+    void run(const koopa_raw_function_t &func, int num_regs)
+    {
+        reg.clear();
+        used_callee_saved.clear();
+        slot.clear();
+        num_slots = 0;
+
+        vector<LiveInterval> intervals;
+        build_intervals(func, intervals);
+        sort(intervals.begin(), intervals.end(),
+             [](const LiveInterval &a, const LiveInterval &b)
+             { return a.start < b.start; });
+        reg.reserve(intervals.size());
+        slot.reserve(intervals.size());
+        if (num_regs > 0)
+            assign_regs(intervals, num_regs);
+        assign_slots(intervals);
+    }
+
+private:
+    void assign_regs(vector<LiveInterval> &intervals, int num_regs)
+    {
+        vector<bool> free_reg(num_regs, true);
+        vector<bool> ever_used(num_regs, false);
+        vector<LiveInterval *> active; // sorted by increasing end
+        for (auto &cur : intervals)
+        {
+            // an operand dying at cur.start may share cur's register, since
+            // every instruction reads its operands before writing its result
+            while (!active.empty() && active.front()->end <= cur.start)
+            {
+                free_reg[reg[active.front()->value]] = true;
+                active.erase(active.begin());
+            }
+
+            int r = find(free_reg.begin(), free_reg.end(), true) - free_reg.begin();
+            if (r == num_regs)
+            {
+                LiveInterval *victim = active.back();
+                if (victim->end <= cur.end)
+                    continue;
+                r = reg[victim->value];
+                reg.erase(victim->value);
+                active.pop_back();
+            }
+            free_reg[r] = false;
+            ever_used[r] = true;
+            reg[cur.value] = r;
+            auto pos = upper_bound(active.begin(), active.end(), &cur,
+                                   [](const LiveInterval *a, const LiveInterval *b)
+                                   { return a->end < b->end; });
+            active.insert(pos, &cur);
+        }
+
+        for (int r = first_callee_saved; r < num_regs; ++r)
+            if (ever_used[r])
+                used_callee_saved.push_back(r);
+    }
+
+    void assign_slots(const vector<LiveInterval> &intervals)
+    {
+        // (end, slot) of the spilled intervals still live, earliest end first
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> active;
+        priority_queue<int, vector<int>, greater<int>> free_slots;
+        for (const auto &cur : intervals)
+        {
+            if (reg.count(cur.value) != 0)
+                continue;
+            while (!active.empty() && active.top().first <= cur.start)
+            {
+                free_slots.push(active.top().second);
+                active.pop();
+            }
+            int s;
+            if (free_slots.empty())
+                s = num_slots++;
+            else
+            {
+                s = free_slots.top();
+                free_slots.pop();
+            }
+            slot[cur.value] = s;
+            active.push({cur.end, s});
+        }
+    }
+
+    void build_intervals(const koopa_raw_function_t &func, vector<LiveInterval> &intervals)
+    {
+        CFG cfg(func);
+        size_t n = cfg.size();
+        const auto &bbs = cfg.bbs;
+        const auto &succ = cfg.succ;
+
+        // An interval for every value, opened where the value is defined.
+        unordered_map<koopa_raw_value_t, size_t> interval_of;
+        vector<size_t> def_block;
+        size_t num_values = 0;
+        for (auto bb : bbs)
+            num_values += bb->params.len + bb->insts.len;
+        interval_of.reserve(num_values);
+        intervals.reserve(num_values);
+        auto define = [&](koopa_raw_value_t value, int pos, size_t block)
+        {
+            interval_of[value] = intervals.size();
+            intervals.push_back(LiveInterval{value, pos, pos});
+            def_block.push_back(block);
+        };
+        for (size_t i = 0, pos = 0; i < n; ++i)
+        {
+            for (size_t j = 0; j < bbs[i]->params.len; ++j)
+                define(reinterpret_cast<koopa_raw_value_t>(bbs[i]->params.buffer[j]), pos, i);
+            const auto &insts = bbs[i]->insts;
+            for (size_t j = 0; j < insts.len; ++j, ++pos)
+            {
+                auto inst = reinterpret_cast<koopa_raw_value_t>(insts.buffer[j]);
+                if (needs_reg(inst))
+                    define(inst, pos, i);
+            }
+        }
+
+        // Only values used outside the block defining them take part in
+        // block-level liveness; the others live from definition to last
+        // use, which numbering the instructions covers.
+        vector<unordered_set<koopa_raw_value_t>> use(n), def(n), live_in(n), live_out(n);
+        vector<koopa_raw_value_t> ops;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const auto &insts = bbs[i]->insts;
+            for (size_t j = 0; j < insts.len; ++j)
+            {
+                ops.clear();
+                reg_operands(reinterpret_cast<koopa_raw_value_t>(insts.buffer[j]), ops);
+                for (auto op : ops)
+                {
+                    size_t d = def_block[interval_of.at(op)];
+                    if (d != i)
+                    {
+                        use[i].insert(op);
+                        def[d].insert(op);
+                    }
+                }
+            }
+        }
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = n; i-- > 0;)
+            {
+                for (auto s : succ[i])
+                    for (auto v : live_in[s])
+                        changed |= live_out[i].insert(v).second;
+                for (auto v : live_out[i])
+                    if (def[i].count(v) == 0)
+                        changed |= live_in[i].insert(v).second;
+                for (auto v : use[i])
+                    changed |= live_in[i].insert(v).second;
+            }
+        }
+
+        auto extend = [&](koopa_raw_value_t value, int pos)
+        {
+            auto &interval = intervals[interval_of.at(value)];
+            interval.start = min(interval.start, pos);
+            interval.end = max(interval.end, pos);
+        };
+
+        auto extend_params = [&](koopa_raw_basic_block_t bb, int pos)
+        {
+            for (size_t k = 0; k < bb->params.len; ++k)
+                extend(reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[k]), pos);
+        };
+
+        int pos = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            int block_start = pos;
+            for (auto v : live_in[i])
+                extend(v, block_start);
+            extend_params(bbs[i], block_start);
+            const auto &insts = bbs[i]->insts;
+            for (size_t j = 0; j < insts.len; ++j, ++pos)
+            {
+                auto inst = reinterpret_cast<koopa_raw_value_t>(insts.buffer[j]);
+                ops.clear();
+                reg_operands(inst, ops);
+                for (auto op : ops)
+                    extend(op, pos);
+                if (needs_reg(inst))
+                    extend(inst, pos);
+                if (inst->kind.tag == KOOPA_RVT_BRANCH)
+                {
+                    extend_params(inst->kind.data.branch.true_bb, pos);
+                    extend_params(inst->kind.data.branch.false_bb, pos);
+                }
+                else if (inst->kind.tag == KOOPA_RVT_JUMP)
+                    extend_params(inst->kind.data.jump.target, pos);
+            }
+            for (auto v : live_out[i])
+                extend(v, pos);
+        }
+    }
+};
@@ -1,35 +1,207 @@
 #pragma once
 
-#include <iostream>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
 #include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
 #include <tr1/unordered_map>
+#include <utility>
+#include <vector>
+#include "asm.h"
+#include "asm_writer.h"
+#include "ir.h"
 #include "koopa.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "stats.h"
 
 using namespace std;
 
-static tr1::unordered_map<uintptr_t, int> off;
-
-void visit(const koopa_raw_program_t &program);
-void visit(const koopa_raw_slice_t &slice);
-void visit(const koopa_raw_function_t &func);
-void visit(const koopa_raw_basic_block_t &bb);
-void visit(const koopa_raw_value_t &value);
-void visit(const koopa_raw_return_t &ret);
-void visit(const koopa_raw_integer_t &integer);
-void print_globl(const koopa_raw_slice_t &slice);
-int calc_stack_frame_size(const koopa_raw_slice_t &slice);
-bool has_return_value(const koopa_raw_value_t &value);
-string offset(const koopa_raw_value_t &value);
-
-void visit(const koopa_raw_program_t &program)
+// The operation computing c op x as x op' c, or -1 if there is none
+static const int swapped_op[] = {
+    KOOPA_RBO_NOT_EQ, KOOPA_RBO_EQ, KOOPA_RBO_LT, KOOPA_RBO_GT, KOOPA_RBO_LE, KOOPA_RBO_GE, KOOPA_RBO_ADD, -1,
+    KOOPA_RBO_MUL, -1, -1, KOOPA_RBO_AND, KOOPA_RBO_OR, KOOPA_RBO_XOR, -1, -1, -1};
+
+// Magic number m and shift s for signed division by d, 2 <= |d|: the
+// quotient is the high word of m * x, corrected by x when the signs of m
+// and d differ, shifted right by s (Hacker's Delight, figure 10-1).
+static void magic_div(int d, int &m, int &s)
+{
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = d < 0 ? -static_cast<uint32_t>(d) : d;
+    uint32_t t = two31 + (static_cast<uint32_t>(d) >> 31);
+    uint32_t anc = t - 1 - t % ad;
+    int p = 31;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    do
+    {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    uint32_t magic = q2 + 1;
+    m = static_cast<int>(d < 0 ? -magic : magic);
+    s = p - 32;
+}
+
+// RISC-V instruction for each koopa_raw_binary_op_t without a special case
+static const AsmOp binary_inst[] = {
+    AsmOp::ADD, AsmOp::ADD, AsmOp::SGT, AsmOp::SLT, AsmOp::ADD, AsmOp::ADD, AsmOp::ADD, AsmOp::SUB, AsmOp::MUL,
+    AsmOp::DIV, AsmOp::REM, AsmOp::AND, AsmOp::OR, AsmOp::XOR, AsmOp::SLL, AsmOp::SRL, AsmOp::SRA};
+
+// Where a value is kept: a register, a stack slot, or nowhere for an
+// immediate.
+struct Location
+{
+    enum Kind
+    {
+        REG,
+        SLOT,
+        IMM
+    } kind;
+    int value; // Reg, byte offset or the immediate
+
+    bool operator==(const Location &other) const
+    {
+        return kind == other.kind && value == other.value;
+    }
+};
+
+// Lowers a raw program to RISC-V assembly in out. All code generation
+// state lives in the generator, so every compilation uses its own. With
+// several workers, functions are generated in parallel by one generator
+// per worker, each into its own buffer, and the buffers are joined in
+// program order so the output does not depend on scheduling.
+class RiscvGen
 {
-    cout << ".text" << endl;
-    print_globl(program.funcs);
+public:
+    AsmWriter out;
+    Peephole peephole;
+    // Set by -obj: out receives machine code instead of assembly text, and
+    // func_sizes the size of each function's code in program order.
+    bool object = false;
+    vector<size_t> func_sizes;
+
+    RiscvGen(PassStats &stats, bool use_regalloc, bool use_peephole, int workers = 1)
+        : stats(stats), use_regalloc(use_regalloc), use_peephole(use_peephole), workers(workers)
+    {
+    }
+
+    void visit(const koopa_raw_program_t &program);
+
+private:
+    PassStats &stats;
+    // Set by -O1: keep values in registers instead of a stack slot each.
+    bool use_regalloc;
+    // Set by -O1 as well: clean up the instruction list before printing.
+    bool use_peephole;
+    int workers;
+
+    tr1::unordered_map<uintptr_t, int> off;
+    LinearScan ra;
+    koopa_raw_function_t cur_func;
+    AsmFunction asm_func;
+    tr1::unordered_map<uintptr_t, int> label_id;
+    int stack_frame_size;
+
+    void visit_parallel(const koopa_raw_slice_t &funcs);
+    void visit(const koopa_raw_slice_t &slice);
+    void visit(const koopa_raw_function_t &func);
+    void visit(const koopa_raw_basic_block_t &bb);
+    void visit(const koopa_raw_value_t &value);
+    void visit(const koopa_raw_return_t &ret);
+    void visit(const koopa_raw_integer_t &integer);
+    void print_globl(const koopa_raw_slice_t &slice);
+    int label(const koopa_raw_basic_block_t &bb);
+    int calc_stack_frame_size(const koopa_raw_function_t &func);
+    int offset(const koopa_raw_value_t &value);
+    void emit_load(Reg rd, int offset);
+    void emit_store(Reg rs, int offset);
+    void emit_sp_adjust(int bytes);
+    void emit_binary(const koopa_raw_value_t &value);
+    bool emit_binary_imm(koopa_raw_binary_op_t op, Reg x, int c, Reg rd);
+    void emit_div_imm(Reg x, int d, Reg rd, bool rem);
+    Reg load_operand(const koopa_raw_value_t &value, Reg scratch);
+    Reg result_reg(const koopa_raw_value_t &value);
+    void store_result(const koopa_raw_value_t &value, Reg rd);
+    Location location(const koopa_raw_value_t &value);
+    void emit_move(const Location &dst, const Location &src);
+    void emit_edge_moves(const koopa_raw_basic_block_t &target, const koopa_raw_slice_t &args);
+};
+
+void RiscvGen::visit(const koopa_raw_program_t &program)
+{
+    if (!object)
+    {
+        out << ".text\n";
+        print_globl(program.funcs);
+    }
     visit(program.values);
-    visit(program.funcs);
+    if (workers > 1 && program.funcs.len > 1)
+        visit_parallel(program.funcs);
+    else
+        visit(program.funcs);
+}
+
+void RiscvGen::visit_parallel(const koopa_raw_slice_t &funcs)
+{
+    size_t n_workers = min(static_cast<size_t>(workers), static_cast<size_t>(funcs.len));
+    vector<string> text(funcs.len);
+    vector<PassStats> worker_stats(n_workers);
+    vector<unique_ptr<RiscvGen>> gens;
+    for (size_t w = 0; w < n_workers; ++w)
+    {
+        worker_stats[w].timing = stats.timing;
+        gens.emplace_back(new RiscvGen(worker_stats[w], use_regalloc, use_peephole));
+        gens.back()->object = object;
+    }
+
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for (size_t w = 0; w < n_workers; ++w)
+        pool.emplace_back([&, w]()
+                          {
+            RiscvGen &gen = *gens[w];
+            for (size_t i = next++; i < funcs.len; i = next++)
+            {
+                gen.visit(reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]));
+                text[i] = gen.out.take();
+            } });
+    for (auto &worker : pool)
+        worker.join();
+
+    for (size_t i = 0; i < funcs.len; ++i)
+    {
+        out << text[i];
+        func_sizes.push_back(text[i].size());
+    }
+    for (size_t w = 0; w < n_workers; ++w)
+    {
+        stats.merge(worker_stats[w]);
+        peephole.merge(gens[w]->peephole);
+    }
 }
 
-void visit(const koopa_raw_slice_t &slice)
+void RiscvGen::visit(const koopa_raw_slice_t &slice)
 {
     for (size_t i = 0; i < slice.len; ++i)
     {
@@ -51,16 +223,55 @@ void visit(const koopa_raw_slice_t &slice)
     }
 }
 
-void visit(const koopa_raw_function_t &func)
+void RiscvGen::visit(const koopa_raw_function_t &func)
 {
-    cout << func->name+1 << ":" << endl;
+    cur_func = func;
+    asm_func.name = func->name + 1;
+    asm_func.code.clear();
+    asm_func.label_names.clear();
+    label_id.clear();
+    for (size_t i = 0; i < func->bbs.len; ++i)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        label_id[reinterpret_cast<uintptr_t>(bb)] = i;
+        asm_func.label_names.push_back(bb->name + 1);
+    }
+
+    stats.start("regalloc");
+    ra.run(func, use_regalloc ? num_alloc_regs : 0);
+    stats.stop();
+    stats.start("isel");
+    stack_frame_size = calc_stack_frame_size(func);
+    emit_sp_adjust(-stack_frame_size * 4);
+    for (size_t k = 0; k < ra.used_callee_saved.size(); ++k)
+        emit_store(alloc_regs[ra.used_callee_saved[k]], k * 4);
     visit(func->bbs);
+    stats.stop();
+
+    if (use_peephole)
+    {
+        stats.start("peephole");
+        peephole.run(asm_func.code);
+        stats.stop();
+    }
+    if (object)
+    {
+        stats.start("encode");
+        size_t start = out.size();
+        asm_func.encode(out);
+        func_sizes.push_back(out.size() - start);
+        stats.stop();
+        return;
+    }
+    stats.start("print");
+    asm_func.print(out);
+    stats.stop();
 }
 
-void visit(const koopa_raw_basic_block_t &bb)
+void RiscvGen::visit(const koopa_raw_basic_block_t &bb)
 {
-    int stack_frame_size = calc_stack_frame_size(bb->insts);
-    cout << "addi sp, sp, -" + to_string(stack_frame_size * 4) << endl;
+    if (bb != cur_func->bbs.buffer[0])
+        asm_func.emit(AsmOp::LABEL, Reg::none, Reg::none, Reg::none, label(bb));
     auto slice = bb->insts;
     for (size_t i = 0; i < slice.len; ++i)
     {
@@ -71,189 +282,74 @@ void visit(const koopa_raw_basic_block_t &bb)
         {
         case KOOPA_RVT_BINARY:
         {
-            auto lhs = value->kind.data.binary.lhs;
-            auto rhs = value->kind.data.binary.rhs;
-
-            switch (lhs->kind.tag)
-            {
-            case KOOPA_RVT_INTEGER:
-                cout << "li t0, " + to_string(lhs->kind.data.integer.value) << endl;
-                break;
-
-            case KOOPA_RVT_BINARY:
-                cout << "lw t0, " + offset(lhs) << endl;
-                break;
-
-            case KOOPA_RVT_LOAD:
-                cout << "lw t0, " + offset(lhs) << endl;
-                break;
-
-            default:
-                assert(false);
-            }
-
-            switch (rhs->kind.tag)
-            {
-            case KOOPA_RVT_INTEGER:
-                cout << "li t1, " + to_string(rhs->kind.data.integer.value) << endl;
-                break;
-
-            case KOOPA_RVT_BINARY:
-                cout << "lw t1, " + offset(rhs) << endl;
-                break;
-
-            case KOOPA_RVT_LOAD:
-                cout << "lw t1, " + offset(rhs) << endl;
-                break;
-
-            default:
-                assert(false);
-            }
-
-            switch (value->kind.data.binary.op)
-            {
-            case 0: // ne
-            {
-                cout << "xor t2, t0, t1" << endl;
-                cout << "snez t3, t2" << endl;
-                break;
-            }
-
-            case 1: // eq
-            {
-                cout << "xor t2, t0, t1" << endl;
-                cout << "seqz t3, t2" << endl;
-                break;
-            }
-
-            case 2: // gt
-            {
-                cout << "sgt t3, t0, t1" << endl;
-                break;
-            }
-
-            case 3: // lt
-            {
-                cout << "slt t3, t0, t1" << endl;
-                break;
-            }
-
-            case 4: // ge
-            {
-                cout << "addi t0, t0, 1" << endl;
-                cout << "sgt t3, t0, t1" << endl;
-                break;
-            }
-
-            case 5: // le
-            {
-                cout << "addi t1, t1, 1" << endl;
-                cout << "slt t3, t0, t1" << endl;
-                break;
-            }
-
-            case 6: // add
-            {
-                cout << "add t3, t0, t1" << endl;
-                break;
-            }
-
-            case 7: // sub
-            {
-                cout << "sub t3, t0, t1" << endl;
-                break;
-            }
-
-            case 8: // mul
-            {
-                cout << "mul t3, t0, t1" << endl;
-                break;
-            }
-
-            case 9: // div
-            {
-                cout << "div t3, t0, t1" << endl;
-                break;
-            }
+            emit_binary(value);
+            break;
+        }
 
-            case 10: // mod
-            {
-                cout << "rem t3, t0, t1" << endl;
-                break;
-            }
+        case KOOPA_RVT_RETURN:
+        {
+            visit(value->kind.data.ret);
+            break;
+        }
 
-            case 11: // and
-            {
-                cout << "and t3, t0, t1" << endl;
-                break;
-            }
+        case KOOPA_RVT_ALLOC:
+        {
+            break;
+        }
 
-            case 12: // or
+        case KOOPA_RVT_BRANCH:
+        {
+            const auto &branch = value->kind.data.branch;
+            auto cond = load_operand(branch.cond, Reg::t0);
+            // arguments are passed on the edge that is taken, so an edge
+            // with arguments gets its own moves before the jump
+            if (branch.true_args.len == 0)
             {
-                cout << "or t3, t0, t1" << endl;
-                break;
+                asm_func.emit(AsmOp::BNEZ, Reg::none, cond, Reg::none, label(branch.true_bb));
+                emit_edge_moves(branch.false_bb, branch.false_args);
+                asm_func.emit(AsmOp::J, Reg::none, Reg::none, Reg::none, label(branch.false_bb));
             }
-
-            default:
+            else if (branch.false_args.len == 0)
             {
-                break;
+                asm_func.emit(AsmOp::BEQZ, Reg::none, cond, Reg::none, label(branch.false_bb));
+                emit_edge_moves(branch.true_bb, branch.true_args);
+                asm_func.emit(AsmOp::J, Reg::none, Reg::none, Reg::none, label(branch.true_bb));
             }
-            }
-            cout << "sw t3, " + offset(value) << endl;
-            break;
-        }
-
-        case KOOPA_RVT_RETURN:
-        {
-            auto ret = value->kind.data.ret.value;
-
-            switch (ret->kind.tag)
+            else
             {
-            case KOOPA_RVT_INTEGER:
-                cout << "li a0, " + to_string(ret->kind.data.integer.value) << endl;
-                break;
-
-            case KOOPA_RVT_BINARY:
-                cout << "lw a0, " + offset(ret) << endl;
-                break;
-
-            case KOOPA_RVT_LOAD:
-                cout << "lw a0, " + offset(ret) << endl;
-                break;
-
-            default:
-                assert(false);
+                int edge = asm_func.label_names.size();
+                asm_func.label_names.push_back(asm_func.label_names[label(branch.true_bb)] + "_" + to_string(edge));
+                asm_func.emit(AsmOp::BNEZ, Reg::none, cond, Reg::none, edge);
+                emit_edge_moves(branch.false_bb, branch.false_args);
+                asm_func.emit(AsmOp::J, Reg::none, Reg::none, Reg::none, label(branch.false_bb));
+                asm_func.emit(AsmOp::LABEL, Reg::none, Reg::none, Reg::none, edge);
+                emit_edge_moves(branch.true_bb, branch.true_args);
+                asm_func.emit(AsmOp::J, Reg::none, Reg::none, Reg::none, label(branch.true_bb));
             }
-
-            cout << "addi sp, sp, " + to_string(stack_frame_size * 4) << endl;
-            cout << "ret" << endl;
             break;
         }
 
-        case KOOPA_RVT_ALLOC:
+        case KOOPA_RVT_JUMP:
         {
+            emit_edge_moves(value->kind.data.jump.target, value->kind.data.jump.args);
+            asm_func.emit(AsmOp::J, Reg::none, Reg::none, Reg::none, label(value->kind.data.jump.target));
             break;
         }
 
         case KOOPA_RVT_LOAD:
         {
             auto src = value->kind.data.load.src;
-            cout << "lw t0, " + offset(src) + "\n";
-            cout << "sw t0, " + offset(value) + "\n";
+            auto rd = result_reg(value);
+            emit_load(rd, offset(src));
+            store_result(value, rd);
             break;
         }
 
         case KOOPA_RVT_STORE:
         {
-            auto src = value->kind.data.store.value;
+            auto src = load_operand(value->kind.data.store.value, Reg::t0);
             auto dest = value->kind.data.store.dest;
-
-            if (src->kind.tag == KOOPA_RVT_INTEGER)
-                cout << "li t0, " + to_string(src->kind.data.integer.value) + "\n";
-            else
-                cout << "lw t0, " + offset(src) + "\n";
-
-            cout << "sw t0, " + offset(dest) + "\n";
+            emit_store(src, offset(dest));
             break;
         }
 
@@ -265,7 +361,7 @@ void visit(const koopa_raw_basic_block_t &bb)
     }
 }
 
-void visit(const koopa_raw_value_t &value)
+void RiscvGen::visit(const koopa_raw_value_t &value)
 {
     const auto &kind = value->kind;
     switch (kind.tag)
@@ -281,42 +377,62 @@ void visit(const koopa_raw_value_t &value)
     }
 }
 
-void visit(const koopa_raw_return_t &ret)
+void RiscvGen::visit(const koopa_raw_return_t &ret)
 {
-    auto ret_value = ret.value;
-    assert(ret_value->kind.tag == KOOPA_RVT_INTEGER);
-    int32_t int_val = ret_value->kind.data.integer.value;
-    cout << "li a0, " << int_val << endl;
-    cout << "ret" << endl;
+    auto value = load_operand(ret.value, Reg::a0);
+    if (value != Reg::a0)
+        asm_func.emit(AsmOp::MV, Reg::a0, value);
+    for (size_t k = 0; k < ra.used_callee_saved.size(); ++k)
+        emit_load(alloc_regs[ra.used_callee_saved[k]], k * 4);
+    emit_sp_adjust(stack_frame_size * 4);
+    asm_func.emit(AsmOp::RET);
 }
 
-void visit(const koopa_raw_integer_t &integer)
+void RiscvGen::visit(const koopa_raw_integer_t &integer)
 {
 }
 
-void print_globl(const koopa_raw_slice_t &slice)
+void RiscvGen::print_globl(const koopa_raw_slice_t &slice)
 {
     for (size_t i = 0; i < slice.len; ++i)
     {
         auto ptr = slice.buffer[i];
         assert(slice.kind == KOOPA_RSIK_FUNCTION);
         auto func = reinterpret_cast<koopa_raw_function_t>(ptr);
-        cout << ".globl " << func->name+1 << endl;
+        out << ".globl " << func->name + 1 << "\n";
     }
 }
 
-int calc_stack_frame_size(const koopa_raw_slice_t &slice)
+// Block labels are local to the assembly file and qualified by the
+// function, e.g. .Lmain_land_rhs for %land_rhs in @main.
+int RiscvGen::label(const koopa_raw_basic_block_t &bb)
 {
-    int stack_frame_size = 0;
-    for (size_t i = 0; i < slice.len; ++i)
+    return label_id[reinterpret_cast<uintptr_t>(bb)];
+}
+
+// Lays out the frame of func in words, from sp up: the callee-saved
+// registers it uses, the slots the register allocator shares among
+// spilled values, then one slot per alloc. Saves and the short-lived
+// spills come first so they stay within reach of a 12-bit offset in big
+// frames. The size is kept a multiple of 16 bytes.
+int RiscvGen::calc_stack_frame_size(const koopa_raw_function_t &func)
+{
+    off.clear();
+    int stack_frame_size = ra.used_callee_saved.size();
+    for (const auto &spill : ra.slot)
+        off[reinterpret_cast<uintptr_t>(spill.first)] = stack_frame_size + spill.second;
+    stack_frame_size += ra.num_slots;
+    for (size_t i = 0; i < func->bbs.len; ++i)
     {
-        auto ptr = slice.buffer[i];
-        assert(slice.kind == KOOPA_RSIK_VALUE);
-        auto value = reinterpret_cast<koopa_raw_value_t>(ptr);
-        if (value->kind.tag == KOOPA_RVT_ALLOC || has_return_value(value))
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        auto slice = bb->insts;
+        for (size_t j = 0; j < slice.len; ++j)
         {
-            off[reinterpret_cast<uintptr_t>(value)] = stack_frame_size;
-            stack_frame_size++;
+            auto ptr = slice.buffer[j];
+            assert(slice.kind == KOOPA_RSIK_VALUE);
+            auto value = reinterpret_cast<koopa_raw_value_t>(ptr);
+            if (value->kind.tag == KOOPA_RVT_ALLOC)
+                off[reinterpret_cast<uintptr_t>(value)] = stack_frame_size++;
         }
     }
     if ((stack_frame_size & 3) > 0)
@@ -326,12 +442,388 @@ int calc_stack_frame_size(const koopa_raw_slice_t &slice)
     return stack_frame_size;
 }
 
-bool has_return_value(const koopa_raw_value_t &value)
+int RiscvGen::offset(const koopa_raw_value_t &value)
+{
+    return off[reinterpret_cast<uintptr_t>(value)] * 4;
+}
+
+// sp-relative accesses and adjustments. An offset that does not fit the
+// 12-bit immediate is added to sp in a register first: the loaded
+// register itself for a load, t2 for a store.
+static bool fits_imm12(int x)
+{
+    return x >= -2048 && x <= 2047;
+}
+
+void RiscvGen::emit_load(Reg rd, int offset)
+{
+    if (fits_imm12(offset))
+    {
+        asm_func.emit(AsmOp::LW, rd, Reg::sp, Reg::none, offset);
+        return;
+    }
+    asm_func.emit(AsmOp::LI, rd, Reg::none, Reg::none, offset);
+    asm_func.emit(AsmOp::ADD, rd, Reg::sp, rd);
+    asm_func.emit(AsmOp::LW, rd, rd, Reg::none, 0);
+}
+
+void RiscvGen::emit_store(Reg rs, int offset)
+{
+    if (fits_imm12(offset))
+    {
+        asm_func.emit(AsmOp::SW, Reg::none, Reg::sp, rs, offset);
+        return;
+    }
+    asm_func.emit(AsmOp::LI, Reg::t2, Reg::none, Reg::none, offset);
+    asm_func.emit(AsmOp::ADD, Reg::t2, Reg::sp, Reg::t2);
+    asm_func.emit(AsmOp::SW, Reg::none, Reg::t2, rs, 0);
+}
+
+// Moves sp by bytes; t0 carries an amount too large for addi, which is
+// free in the prologue and after the return value is in a0.
+void RiscvGen::emit_sp_adjust(int bytes)
+{
+    if (bytes == 0)
+        return;
+    if (fits_imm12(bytes))
+    {
+        asm_func.emit(AsmOp::ADDI, Reg::sp, Reg::sp, Reg::none, bytes);
+        return;
+    }
+    asm_func.emit(AsmOp::LI, Reg::t0, Reg::none, Reg::none, bytes);
+    asm_func.emit(AsmOp::ADD, Reg::sp, Reg::sp, Reg::t0);
+}
+
+// Lowers a binary instruction. Two constant operands are folded. A single
+// one is kept on the right where the operation allows it, and becomes an
+// immediate form, a shift or a multiply by a magic number when one fits;
+// anything else brings both operands into registers.
+void RiscvGen::emit_binary(const koopa_raw_value_t &value)
+{
+    const auto &binary = value->kind.data.binary;
+    auto op = binary.op;
+    auto lhs = binary.lhs, rhs = binary.rhs;
+    int folded;
+    if (lhs->kind.tag == KOOPA_RVT_INTEGER && rhs->kind.tag == KOOPA_RVT_INTEGER &&
+        eval_binary(op, lhs->kind.data.integer.value, rhs->kind.data.integer.value, folded))
+    {
+        // operands that only became constant after mem2reg
+        auto rd = result_reg(value);
+        asm_func.emit(AsmOp::LI, rd, Reg::none, Reg::none, folded);
+        store_result(value, rd);
+        return;
+    }
+    if (lhs->kind.tag == KOOPA_RVT_INTEGER && rhs->kind.tag != KOOPA_RVT_INTEGER && swapped_op[op] >= 0)
+    {
+        op = static_cast<koopa_raw_binary_op_t>(swapped_op[op]);
+        swap(lhs, rhs);
+    }
+    auto x = load_operand(lhs, Reg::t0);
+    auto rd = result_reg(value);
+    if (rhs->kind.tag == KOOPA_RVT_INTEGER && emit_binary_imm(op, x, rhs->kind.data.integer.value, rd))
+    {
+        store_result(value, rd);
+        return;
+    }
+
+    auto y = load_operand(rhs, Reg::t1);
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+        asm_func.emit(AsmOp::XOR, rd, x, y);
+        asm_func.emit(AsmOp::SNEZ, rd, rd);
+        break;
+
+    case KOOPA_RBO_EQ:
+        asm_func.emit(AsmOp::XOR, rd, x, y);
+        asm_func.emit(AsmOp::SEQZ, rd, rd);
+        break;
+
+    case KOOPA_RBO_GE: // !(x < y)
+        asm_func.emit(AsmOp::SLT, rd, x, y);
+        asm_func.emit(AsmOp::XORI, rd, rd, Reg::none, 1);
+        break;
+
+    case KOOPA_RBO_LE: // !(x > y)
+        asm_func.emit(AsmOp::SGT, rd, x, y);
+        asm_func.emit(AsmOp::XORI, rd, rd, Reg::none, 1);
+        break;
+
+    default:
+        asm_func.emit(binary_inst[op], rd, x, y);
+        break;
+    }
+    store_result(value, rd);
+}
+
+// Emits rd = x op c without materializing c where a cheaper form exists.
+// Returns false, having emitted nothing, when there is none.
+bool RiscvGen::emit_binary_imm(koopa_raw_binary_op_t op, Reg x, int c, Reg rd)
 {
-    return value->ty->tag != KOOPA_RTT_UNIT;
+    // c + 1 and -c, when they exist and fit an immediate
+    bool next_fits = c != INT32_MAX && fits_imm12(c + 1);
+    bool neg_fits = c != INT32_MIN && fits_imm12(-c);
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+    case KOOPA_RBO_EQ:
+    {
+        auto set = op == KOOPA_RBO_EQ ? AsmOp::SEQZ : AsmOp::SNEZ;
+        if (c == 0)
+        {
+            asm_func.emit(set, rd, x);
+            return true;
+        }
+        if (!fits_imm12(c))
+            return false;
+        asm_func.emit(AsmOp::XORI, rd, x, Reg::none, c);
+        asm_func.emit(set, rd, rd);
+        return true;
+    }
+
+    case KOOPA_RBO_LT:
+        if (!fits_imm12(c))
+            return false;
+        asm_func.emit(AsmOp::SLTI, rd, x, Reg::none, c);
+        return true;
+
+    case KOOPA_RBO_GE: // !(x < c)
+        if (!fits_imm12(c))
+            return false;
+        asm_func.emit(AsmOp::SLTI, rd, x, Reg::none, c);
+        asm_func.emit(AsmOp::XORI, rd, rd, Reg::none, 1);
+        return true;
+
+    case KOOPA_RBO_LE: // x < c + 1
+        if (!next_fits)
+            return false;
+        asm_func.emit(AsmOp::SLTI, rd, x, Reg::none, c + 1);
+        return true;
+
+    case KOOPA_RBO_GT: // !(x < c + 1)
+        if (!next_fits)
+            return false;
+        asm_func.emit(AsmOp::SLTI, rd, x, Reg::none, c + 1);
+        asm_func.emit(AsmOp::XORI, rd, rd, Reg::none, 1);
+        return true;
+
+    case KOOPA_RBO_ADD:
+        if (!fits_imm12(c))
+            return false;
+        asm_func.emit(AsmOp::ADDI, rd, x, Reg::none, c);
+        return true;
+
+    case KOOPA_RBO_SUB:
+        if (!neg_fits)
+            return false;
+        asm_func.emit(AsmOp::ADDI, rd, x, Reg::none, -c);
+        return true;
+
+    case KOOPA_RBO_AND:
+    case KOOPA_RBO_OR:
+    case KOOPA_RBO_XOR:
+        if (!fits_imm12(c))
+            return false;
+        asm_func.emit(op == KOOPA_RBO_AND ? AsmOp::ANDI : op == KOOPA_RBO_OR ? AsmOp::ORI : AsmOp::XORI,
+                      rd, x, Reg::none, c);
+        return true;
+
+    case KOOPA_RBO_SHL:
+    case KOOPA_RBO_SHR:
+    case KOOPA_RBO_SAR:
+        asm_func.emit(op == KOOPA_RBO_SHL ? AsmOp::SLLI : op == KOOPA_RBO_SHR ? AsmOp::SRLI : AsmOp::SRAI,
+                      rd, x, Reg::none, c & 31);
+        return true;
+
+    case KOOPA_RBO_MUL:
+    {
+        uint32_t u = c;
+        if (c == -1)
+            asm_func.emit(AsmOp::SUB, rd, Reg::zero, x);
+        else if (u != 0 && (u & (u - 1)) == 0)
+            asm_func.emit(AsmOp::SLLI, rd, x, Reg::none, __builtin_ctz(u));
+        else
+            return false;
+        return true;
+    }
+
+    case KOOPA_RBO_DIV:
+    case KOOPA_RBO_MOD:
+        // division by zero is left to the hardware
+        if (c == 0)
+            return false;
+        emit_div_imm(x, c, rd, op == KOOPA_RBO_MOD);
+        return true;
+
+    default:
+        return false;
+    }
 }
 
-string offset(const koopa_raw_value_t &value)
+// rd = x / d or x % d, rounding toward zero, for a constant d != 0. A
+// power of two is a shift after adding d - 1 to a negative x; any other d
+// multiplies by a magic number and takes the high word (Granlund &
+// Montgomery; Hacker's Delight, 10-1). The remainder is x - q * d. Only
+// t1 and t2 are used as temporaries, and rd is written last, so rd may be
+// the register holding x.
+void RiscvGen::emit_div_imm(Reg x, int d, Reg rd, bool rem)
 {
-    return to_string(off[reinterpret_cast<uintptr_t>(value)] * 4) + "(sp)";
-}
\ No newline at end of file
+    if (d == 1 || d == -1)
+    {
+        if (rem)
+            asm_func.emit(AsmOp::MV, rd, Reg::zero);
+        else if (d == 1)
+            asm_func.emit(AsmOp::MV, rd, x);
+        else
+            asm_func.emit(AsmOp::SUB, rd, Reg::zero, x);
+        return;
+    }
+
+    if (d > 0 && (d & (d - 1)) == 0)
+    {
+        int k = __builtin_ctz(d);
+        // t1 = x + (x < 0 ? d - 1 : 0)
+        if (k == 1)
+            asm_func.emit(AsmOp::SRLI, Reg::t1, x, Reg::none, 31);
+        else
+        {
+            asm_func.emit(AsmOp::SRAI, Reg::t1, x, Reg::none, 31);
+            asm_func.emit(AsmOp::SRLI, Reg::t1, Reg::t1, Reg::none, 32 - k);
+        }
+        asm_func.emit(AsmOp::ADD, Reg::t1, x, Reg::t1);
+        if (!rem)
+        {
+            asm_func.emit(AsmOp::SRAI, rd, Reg::t1, Reg::none, k);
+            return;
+        }
+        if (fits_imm12(-d))
+            asm_func.emit(AsmOp::ANDI, Reg::t1, Reg::t1, Reg::none, -d);
+        else
+        {
+            asm_func.emit(AsmOp::LI, Reg::t2, Reg::none, Reg::none, -d);
+            asm_func.emit(AsmOp::AND, Reg::t1, Reg::t1, Reg::t2);
+        }
+        asm_func.emit(AsmOp::SUB, rd, x, Reg::t1);
+        return;
+    }
+
+    int m, shift;
+    magic_div(d, m, shift);
+    asm_func.emit(AsmOp::LI, Reg::t1, Reg::none, Reg::none, m);
+    asm_func.emit(AsmOp::MULH, Reg::t1, x, Reg::t1);
+    if (d > 0 && m < 0)
+        asm_func.emit(AsmOp::ADD, Reg::t1, Reg::t1, x);
+    else if (d < 0 && m > 0)
+        asm_func.emit(AsmOp::SUB, Reg::t1, Reg::t1, x);
+    if (shift > 0)
+        asm_func.emit(AsmOp::SRAI, Reg::t1, Reg::t1, Reg::none, shift);
+    // round toward zero: add 1 to a negative quotient
+    asm_func.emit(AsmOp::SRLI, Reg::t2, Reg::t1, Reg::none, 31);
+    if (!rem)
+    {
+        asm_func.emit(AsmOp::ADD, rd, Reg::t1, Reg::t2);
+        return;
+    }
+    asm_func.emit(AsmOp::ADD, Reg::t1, Reg::t1, Reg::t2);
+    asm_func.emit(AsmOp::LI, Reg::t2, Reg::none, Reg::none, d);
+    asm_func.emit(AsmOp::MUL, Reg::t1, Reg::t1, Reg::t2);
+    asm_func.emit(AsmOp::SUB, rd, x, Reg::t1);
+}
+
+// Returns the register holding value. Immediates and spilled values are
+// first brought into scratch.
+Reg RiscvGen::load_operand(const koopa_raw_value_t &value, Reg scratch)
+{
+    if (value->kind.tag == KOOPA_RVT_INTEGER)
+    {
+        if (value->kind.data.integer.value == 0)
+            return Reg::zero;
+        asm_func.emit(AsmOp::LI, scratch, Reg::none, Reg::none, value->kind.data.integer.value);
+        return scratch;
+    }
+    auto it = ra.reg.find(value);
+    if (it != ra.reg.end())
+        return alloc_regs[it->second];
+    emit_load(scratch, offset(value));
+    return scratch;
+}
+
+// Returns the register value should be computed into: its own register,
+// or the scratch t3 when it is spilled.
+Reg RiscvGen::result_reg(const koopa_raw_value_t &value)
+{
+    auto it = ra.reg.find(value);
+    if (it != ra.reg.end())
+        return alloc_regs[it->second];
+    return Reg::t3;
+}
+
+void RiscvGen::store_result(const koopa_raw_value_t &value, Reg rd)
+{
+    if (ra.reg.count(value) == 0)
+        emit_store(rd, offset(value));
+}
+
+Location RiscvGen::location(const koopa_raw_value_t &value)
+{
+    if (value->kind.tag == KOOPA_RVT_INTEGER)
+        return Location{Location::IMM, value->kind.data.integer.value};
+    auto it = ra.reg.find(value);
+    if (it != ra.reg.end())
+        return Location{Location::REG, static_cast<int>(alloc_regs[it->second])};
+    return Location{Location::SLOT, offset(value)};
+}
+
+void RiscvGen::emit_move(const Location &dst, const Location &src)
+{
+    Reg rd = dst.kind == Location::REG ? static_cast<Reg>(dst.value) : Reg::t1;
+    if (src.kind == Location::REG && dst.kind == Location::REG)
+        asm_func.emit(AsmOp::MV, rd, static_cast<Reg>(src.value));
+    else if (src.kind == Location::SLOT)
+        emit_load(rd, src.value);
+    else if (src.kind == Location::IMM)
+        asm_func.emit(AsmOp::LI, rd, Reg::none, Reg::none, src.value);
+    else
+        rd = static_cast<Reg>(src.value);
+    if (dst.kind == Location::SLOT)
+        emit_store(rd, dst.value);
+}
+
+// Copies args into the parameters of target as one parallel assignment:
+// a move goes out once no other pending move still reads its
+// destination, and a cycle is broken by parking one value in t0.
+void RiscvGen::emit_edge_moves(const koopa_raw_basic_block_t &target, const koopa_raw_slice_t &args)
+{
+    vector<pair<Location, Location>> moves;
+    for (size_t i = 0; i < args.len; ++i)
+    {
+        auto dst = location(reinterpret_cast<koopa_raw_value_t>(target->params.buffer[i]));
+        auto src = location(reinterpret_cast<koopa_raw_value_t>(args.buffer[i]));
+        if (!(dst == src))
+            moves.emplace_back(dst, src);
+    }
+    while (!moves.empty())
+    {
+        size_t ready = 0;
+        for (; ready < moves.size(); ++ready)
+        {
+            bool read = false;
+            for (size_t k = 0; k < moves.size() && !read; ++k)
+                read = k != ready && moves[k].second == moves[ready].first;
+            if (!read)
+                break;
+        }
+        if (ready < moves.size())
+        {
+            emit_move(moves[ready].first, moves[ready].second);
+            moves.erase(moves.begin() + ready);
+            continue;
+        }
+        Location temp{Location::REG, static_cast<int>(Reg::t0)};
+        Location parked = moves[0].first;
+        emit_move(temp, parked);
+        for (auto &move : moves)
+            if (move.second == parked)
+                move.second = temp;
+    }
+}
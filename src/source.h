@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// A source file held in memory so the scanner lexes it in place. The text
+// is followed by the two NUL bytes flex needs at the end of a buffer it
+// scans without copying. A regular file is mapped over a zeroed anonymous
+// region rounded up past the padding, so the padding is there even when
+// the file ends on a page boundary. Pages are private and writable because
+// flex briefly NUL-terminates each token in the buffer. Anything that
+// cannot be mapped, such as a pipe, is read into memory instead.
+class SourceFile
+{
+public:
+    static const size_t padding = 2;
+
+    SourceFile() = default;
+    SourceFile(const SourceFile &) = delete;
+    SourceFile &operator=(const SourceFile &) = delete;
+
+    ~SourceFile()
+    {
+        if (mapped != 0)
+            munmap(base, mapped);
+    }
+
+    bool open(const char *path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && map(fd, st.st_size);
+        if (!ok)
+            ok = read_all(fd);
+        close(fd);
+        return ok;
+    }
+
+    char *data()
+    {
+        return base;
+    }
+
+    // Length of the text, without the padding.
+    size_t size() const
+    {
+        return len;
+    }
+
+    // Length of the text with the padding, as flex wants it.
+    size_t buffer_size() const
+    {
+        return len + padding;
+    }
+
+private:
+    char *base = nullptr;
+    size_t len = 0;
+    size_t mapped = 0;
+    vector<char> copy;
+
+    bool map(int fd, size_t size)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t total = (size + padding + page - 1) / page * page;
+        void *region = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED)
+            return false;
+        if (size > 0 && mmap(region, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            munmap(region, total);
+            return false;
+        }
+        madvise(region, total, MADV_SEQUENTIAL);
+        base = static_cast<char *>(region);
+        len = size;
+        mapped = total;
+        return true;
+    }
+
+    bool read_all(int fd)
+    {
+        char chunk[64 * 1024];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+            copy.insert(copy.end(), chunk, chunk + n);
+        if (n < 0)
+            return false;
+        len = copy.size();
+        copy.resize(len + padding, '\0');
+        base = copy.data();
+        return true;
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace std;
+
+// Heap allocations made through operator new by the current thread,
+// counted by the replacement operator new in heap_count.cpp.
+extern thread_local size_t heap_allocs;
+extern thread_local size_t heap_bytes;
+
+static long peak_rss_kb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Per-phase wall time, heap allocations and RSS growth for --time-passes,
+// and named counters for --stats. Phases nest, and a phase entered
+// repeatedly (e.g. once per function) accumulates into one row. RSS growth
+// is how far the process's peak RSS rose while the phase ran, so a phase
+// that reuses memory freed earlier shows none; in batch mode other files
+// compiling at the same time add to it.
+class PassStats
+{
+public:
+    bool timing = false;
+
+    void start(const char *name)
+    {
+        if (!timing)
+            return;
+        size_t idx = find_phase(name, static_cast<int>(open.size()));
+        open.push_back(Open{idx, clock::now(), heap_allocs, heap_bytes, peak_rss_kb()});
+    }
+
+    void stop()
+    {
+        if (!timing)
+            return;
+        auto &o = open.back();
+        auto &phase = phases[o.phase];
+        phase.seconds += chrono::duration<double>(clock::now() - o.start).count();
+        phase.allocs += heap_allocs - o.allocs;
+        phase.bytes += heap_bytes - o.bytes;
+        phase.rss_growth_kb += peak_rss_kb() - o.rss_kb;
+        open.pop_back();
+    }
+
+    // Adds the phases another thread timed while working for the phase
+    // open here, nested under it. Parallel work adds up, so such a row
+    // shows the time and RSS growth summed over the threads.
+    void merge(const PassStats &other)
+    {
+        if (!timing)
+            return;
+        int depth = static_cast<int>(open.size());
+        for (const auto &phase : other.phases)
+        {
+            auto &into = phases[find_phase(phase.name, depth + phase.depth)];
+            into.seconds += phase.seconds;
+            into.allocs += phase.allocs;
+            into.bytes += phase.bytes;
+            into.rss_growth_kb += phase.rss_growth_kb;
+        }
+    }
+
+    void count(const char *name, size_t n)
+    {
+        counters.push_back(Counter{name, n});
+    }
+
+    void print_times(FILE *fp) const
+    {
+        fprintf(fp, "%-24s %10s %10s %12s %14s\n", "phase", "wall ms", "allocs", "alloc KB", "RSS growth KB");
+        for (const auto &phase : phases)
+        {
+            string name = string(phase.depth * 2, ' ') + phase.name;
+            fprintf(fp, "%-24s %10.3f %10zu %12zu %14ld\n", name.c_str(), phase.seconds * 1000,
+                    phase.allocs, phase.bytes / 1024, phase.rss_growth_kb);
+        }
+    }
+
+    void print_counts(FILE *fp) const
+    {
+        for (const auto &counter : counters)
+            fprintf(fp, "%-24s %10zu\n", counter.name, counter.value);
+    }
+
+private:
+    using clock = chrono::steady_clock;
+
+    struct Phase
+    {
+        const char *name;
+        int depth;
+        double seconds;
+        size_t allocs;
+        size_t bytes;
+        long rss_growth_kb;
+    };
+
+    struct Open
+    {
+        size_t phase;
+        clock::time_point start;
+        size_t allocs;
+        size_t bytes;
+        long rss_kb;
+    };
+
+    struct Counter
+    {
+        const char *name;
+        size_t value;
+    };
+
+    vector<Phase> phases;
+    vector<Open> open;
+    vector<Counter> counters;
+
+    size_t find_phase(const char *name, int depth)
+    {
+        size_t idx = 0;
+        while (idx < phases.size() && (phases[idx].depth != depth || strcmp(phases[idx].name, name) != 0))
+            ++idx;
+        if (idx == phases.size())
+            phases.push_back(Phase{name, depth, 0, 0, 0, 0});
+        return idx;
+    }
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "arena.h"
+#include "ir.h"
+
+using namespace std;
+
+// Maps every distinct identifier to a dense integer id. The lexer interns
+// each IDENT once, so later phases compare and index by id instead of
+// hashing strings. Names are copied into the arena on first sight, or
+// kept as views into the source when it outlives the interner. Lookup is
+// an open-addressing table of (hash, id) pairs kept at most half full:
+// one probe usually settles a token, and only a matching hash costs a
+// string compare. Unlike a node-based map it allocates only on growth.
+class Interner
+{
+public:
+    bool borrow_names = false;
+
+    explicit Interner(Arena &arena) : arena(arena), slots(64, Slot{0, -1})
+    {
+    }
+
+    int intern(const char *s, size_t len)
+    {
+        uint32_t h = hash(s, len);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask)
+        {
+            Slot &slot = slots[i];
+            if (slot.id < 0)
+            {
+                int id = static_cast<int>(names.size());
+                names.emplace_back(borrow_names ? s : arena.make_string(s, len), len);
+                slot = Slot{h, id};
+                if (names.size() * 2 > slots.size())
+                    grow();
+                return id;
+            }
+            if (slot.hash == h && names[slot.id] == string_view(s, len))
+                return slot.id;
+        }
+    }
+
+    string_view name(int id) const
+    {
+        return names[id];
+    }
+
+    size_t size() const
+    {
+        return names.size();
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t hash;
+        int id; // -1 when empty
+    };
+
+    Arena &arena;
+    vector<Slot> slots; // size is a power of two
+    vector<string_view> names;
+
+    // FNV-1a
+    static uint32_t hash(const char *s, size_t len)
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < len; ++i)
+            h = (h ^ static_cast<unsigned char>(s[i])) * 16777619u;
+        return h;
+    }
+
+    void grow()
+    {
+        vector<Slot> old(slots.size() * 2, Slot{0, -1});
+        old.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (const auto &slot : old)
+        {
+            if (slot.id < 0)
+                continue;
+            size_t i = slot.hash & mask;
+            while (slots[i].id >= 0)
+                i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+};
+
+struct Symbol
+{
+    bool is_const;
+    int value;   // for constants
+    Operand var; // the alloc of a variable
+};
+
+// Block-scoped symbol table over interned ids. innermost[id] indexes the
+// visible binding of id, so lookup is one array access. A binding records
+// the one it shadows, and pop_scope() unwinds exactly the bindings of the
+// scope being left.
+class SymbolTable
+{
+public:
+    void push_scope()
+    {
+        scope_marks.push_back(bindings.size());
+    }
+
+    void pop_scope()
+    {
+        size_t mark = scope_marks.back();
+        scope_marks.pop_back();
+        while (bindings.size() > mark)
+        {
+            innermost[bindings.back().id] = bindings.back().prev;
+            bindings.pop_back();
+        }
+    }
+
+    void define(int id, const Symbol &symbol)
+    {
+        if (static_cast<size_t>(id) >= innermost.size())
+            innermost.resize(id + 1, -1);
+        int prev = innermost[id];
+        assert(prev < static_cast<int>(scope_marks.back()) && "redefinition in the same scope");
+        innermost[id] = bindings.size();
+        bindings.push_back(Binding{id, prev, symbol});
+    }
+
+    // Returns the visible symbol for id, or nullptr if there is none.
+    const Symbol *lookup(int id) const
+    {
+        if (static_cast<size_t>(id) >= innermost.size() || innermost[id] < 0)
+            return nullptr;
+        return &bindings[innermost[id]].symbol;
+    }
+
+private:
+    struct Binding
+    {
+        int id;
+        int prev;
+        Symbol symbol;
+    };
+
+    vector<int> innermost;
+    vector<Binding> bindings;
+    vector<size_t> scope_marks;
+};
@@ -1,7 +1,11 @@
 %code requires {
   #include <memory>
   #include <string>
+  #include "arena.h"
   #include "ast.h"
+  #include "symtab.h"
+
+  typedef void *yyscan_t;
 }
 
 %{
@@ -9,25 +13,33 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include "arena.h"
 #include "ast.h"
-
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
+#include "symtab.h"
 
 using namespace std;
 
 %}
 
-%parse-param { std::unique_ptr<BaseAST> &ast }
+// The parser and the scanner keep their state in the scanner handle and
+// the parameters, so several files can be parsed at once.
+%define api.pure full
+%parse-param { yyscan_t scanner } { BaseAST *&ast } { Arena &arena } { Interner &symbols }
+%lex-param { yyscan_t scanner }
 
 %union {
-  std::string *str_val;
+  int sym_val;
   int int_val;
   BaseAST *ast_val;
 }
 
+%code {
+  int yylex(YYSTYPE *yylval, yyscan_t scanner);
+  void yyerror(yyscan_t scanner, BaseAST *&ast, Arena &arena, Interner &symbols, const char *s);
+}
+
 %token INT RETURN CONST LEQ GEQ EQ NEQ AND OR
-%token <str_val> IDENT
+%token <sym_val> IDENT
 %token <int_val> INT_CONST
 
 %type <ast_val> FuncDef FuncType Block Stmt Exp PrimaryExp Number UnaryExp UnaryOp MulExp AddExp RelExp EqExp LAndExp LOrExp Decl ConstDecl BType ConstDefs ConstDef ConstInitVal BlockItems BlockItem LVal ConstExp VarDecl VarDefs VarDef InitVal
@@ -36,25 +48,25 @@ using namespace std;
 
 CompUnit
   : FuncDef {
-    auto comp_unit = make_unique<CompUnitAST>();
-    comp_unit->func_def = unique_ptr<BaseAST>($1);
-    ast = move(comp_unit);
+    auto comp_unit = arena.make<CompUnitAST>();
+    comp_unit->func_def = $1;
+    ast = comp_unit;
   }
   ;
 
 FuncDef
   : FuncType IDENT '(' ')' Block {
-    auto ast = new FuncDefAST();
-    ast->func_type = unique_ptr<BaseAST>($1);
-    ast->ident = *$2;
-    ast->block = unique_ptr<BaseAST>($5);
+    auto ast = arena.make<FuncDefAST>();
+    ast->func_type = $1;
+    ast->ident = symbols.name($2);
+    ast->block = $5;
     $$ = ast;
   }
   ;
 
 FuncType
   : INT {
-    auto ast = new FuncTypeAST();
+    auto ast = arena.make<FuncTypeAST>();
     ast->_int = "int";
     $$ = ast;
   }
@@ -62,84 +74,82 @@ FuncType
 
 Block
   : '{' BlockItems '}' {
-    auto ast = new BlockAST();
-    ast->block_items = unique_ptr<BaseAST>($2);
+    auto ast = arena.make<BlockAST>();
+    ast->block_items = $2;
     $$ = ast;
   }
   ;
 
 BlockItems
   : BlockItem {
-    auto ast = new BlockItemsAST();
-    ast->block_items = nullptr;
-    ast->block_item = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<BlockItemsAST>();
+    ast->block_items.push_back(arena, $1);
     $$ = ast;
   }
   | BlockItems BlockItem {
-    auto ast = new BlockItemsAST();
-    ast->block_items = unique_ptr<BaseAST>($1);
-    ast->block_item = unique_ptr<BaseAST>($2);
+    auto ast = static_cast<BlockItemsAST *>($1);
+    ast->block_items.push_back(arena, $2);
     $$ = ast;
   }
   ;
 
 BlockItem
   : Decl {
-    auto ast = new BlockItemAST_0();
-    ast->decl = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<BlockItemAST_0>();
+    ast->decl = $1;
     $$ = ast;
   }
   | Stmt {
-    auto ast = new BlockItemAST_1();
-    ast->stmt = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<BlockItemAST_1>();
+    ast->stmt = $1;
     $$ = ast;
   }
   ;
 
 Stmt
   : RETURN Exp ';' {
-    auto ast = new StmtAST_0();
+    auto ast = arena.make<StmtAST_0>();
     ast->_return = "return";
-    ast->exp = unique_ptr<BaseAST>($2);
+    ast->exp = $2;
     $$ = ast;
   }
   | LVal '=' Exp ';' {
-    auto ast = new StmtAST_1();
-    ast->lval = unique_ptr<BaseAST>($1);
-    ast->exp = unique_ptr<BaseAST>($3);
+    auto ast = arena.make<StmtAST_1>();
+    ast->lval = $1;
+    ast->exp = $3;
     $$ = ast;
   }
   ;
 
 Exp
   : LOrExp {
-    auto ast = new ExpAST();
-    ast->lor_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<ExpAST>();
+    ast->lor_exp = $1;
     $$ = ast;
   }
   ;
 
 PrimaryExp
   : '(' Exp ')' {
-    auto ast = new PrimaryExpAST_0();
-    ast->exp = unique_ptr<BaseAST>($2);
+    auto ast = arena.make<PrimaryExpAST_0>();
+    ast->exp = $2;
     $$ = ast;
   }
   | Number {
-    auto ast = new PrimaryExpAST_1();
-    ast->number = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<PrimaryExpAST_1>();
+    ast->number = $1;
     $$ = ast;
   }
   | LVal {
-    auto ast = new PrimaryExpAST_2();
-    ast->lval = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<PrimaryExpAST_2>();
+    ast->lval = $1;
     $$ = ast;
   }
   ;
 
 Number
   : INT_CONST {
-    auto ast = new NumberAST();
+    auto ast = arena.make<NumberAST>();
     ast->int_const = $1;
     $$ = ast;
   }
@@ -147,31 +157,31 @@ Number
 
 UnaryExp
   : PrimaryExp {
-    auto ast = new UnaryExpAST_0();
-    ast->primary_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<UnaryExpAST_0>();
+    ast->primary_exp = $1;
     $$ = ast;
   }
   | UnaryOp UnaryExp {
-    auto ast = new UnaryExpAST_1();
-    ast->unary_op = unique_ptr<BaseAST>($1);
-    ast->unary_exp = unique_ptr<BaseAST>($2);
+    auto ast = arena.make<UnaryExpAST_1>();
+    ast->unary_op = $1;
+    ast->unary_exp = $2;
     $$ = ast;
   }
   ;
 
 UnaryOp
   : '+' {
-    auto ast = new UnaryOpAST();
+    auto ast = arena.make<UnaryOpAST>();
     ast->op = "+";
     $$ = ast;
   }
   | '-' {
-    auto ast = new UnaryOpAST();
+    auto ast = arena.make<UnaryOpAST>();
     ast->op = "-";
     $$ = ast;
   }
   | '!' {
-    auto ast = new UnaryOpAST();
+    auto ast = arena.make<UnaryOpAST>();
     ast->op = "!";
     $$ = ast;
   }
@@ -179,181 +189,179 @@ UnaryOp
 
 MulExp
   : UnaryExp {
-    auto ast = new MulExpAST_0();
-    ast->unary_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<MulExpAST_0>();
+    ast->unary_exp = $1;
     $$ = ast;
   }
   | MulExp '*' UnaryExp {
-    auto ast = new MulExpAST_1();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<MulExpAST_1>();
+    ast->mul_exp = $1;
     ast->op = '*';
-    ast->unary_exp = unique_ptr<BaseAST>($3);
+    ast->unary_exp = $3;
     $$ = ast;
   }
   | MulExp '/' UnaryExp {
-    auto ast = new MulExpAST_1();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<MulExpAST_1>();
+    ast->mul_exp = $1;
     ast->op = '/';
-    ast->unary_exp = unique_ptr<BaseAST>($3);
+    ast->unary_exp = $3;
     $$ = ast;
   }
   | MulExp '%' UnaryExp {
-    auto ast = new MulExpAST_1();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<MulExpAST_1>();
+    ast->mul_exp = $1;
     ast->op = '%';
-    ast->unary_exp = unique_ptr<BaseAST>($3);
+    ast->unary_exp = $3;
     $$ = ast;
   }
   ;
 
 AddExp
   : MulExp {
-    auto ast = new AddExpAST_0();
-    ast->mul_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<AddExpAST_0>();
+    ast->mul_exp = $1;
     $$ = ast;
   }
   | AddExp '+' MulExp {
-    auto ast = new AddExpAST_1();
-    ast->add_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<AddExpAST_1>();
+    ast->add_exp = $1;
     ast->op = '+';
-    ast->mul_exp = unique_ptr<BaseAST>($3);
+    ast->mul_exp = $3;
     $$ = ast;
   }
   | AddExp '-' MulExp {
-    auto ast = new AddExpAST_1();
-    ast->add_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<AddExpAST_1>();
+    ast->add_exp = $1;
     ast->op = '-';
-    ast->mul_exp = unique_ptr<BaseAST>($3);
+    ast->mul_exp = $3;
     $$ = ast;
   }
   ;
 
 RelExp
   : AddExp {
-    auto ast = new RelExpAST_0();
-    ast->add_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<RelExpAST_0>();
+    ast->add_exp = $1;
     $$ = ast;
   }
   | RelExp '<' AddExp {
-    auto ast = new RelExpAST_1();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<RelExpAST_1>();
+    ast->rel_exp = $1;
     ast->op = 0;
-    ast->add_exp = unique_ptr<BaseAST>($3);
+    ast->add_exp = $3;
     $$ = ast;
   }
   | RelExp '>' AddExp {
-    auto ast = new RelExpAST_1();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<RelExpAST_1>();
+    ast->rel_exp = $1;
     ast->op = 1;
-    ast->add_exp = unique_ptr<BaseAST>($3);
+    ast->add_exp = $3;
     $$ = ast;
   }
   | RelExp LEQ AddExp {
-    auto ast = new RelExpAST_1();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<RelExpAST_1>();
+    ast->rel_exp = $1;
     ast->op = 2;
-    ast->add_exp = unique_ptr<BaseAST>($3);
+    ast->add_exp = $3;
     $$ = ast;
   }
   | RelExp GEQ AddExp {
-    auto ast = new RelExpAST_1();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<RelExpAST_1>();
+    ast->rel_exp = $1;
     ast->op = 3;
-    ast->add_exp = unique_ptr<BaseAST>($3);
+    ast->add_exp = $3;
     $$ = ast;
   }
   ;
 
 EqExp
   : RelExp {
-    auto ast = new EqExpAST_0();
-    ast->rel_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<EqExpAST_0>();
+    ast->rel_exp = $1;
     $$ = ast;
   }
   | EqExp EQ RelExp {
-    auto ast = new EqExpAST_1();
-    ast->eq_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<EqExpAST_1>();
+    ast->eq_exp = $1;
     ast->op = 0;
-    ast->rel_exp = unique_ptr<BaseAST>($3);
+    ast->rel_exp = $3;
     $$ = ast;
   }
   | EqExp NEQ RelExp {
-    auto ast = new EqExpAST_1();
-    ast->eq_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<EqExpAST_1>();
+    ast->eq_exp = $1;
     ast->op = 1;
-    ast->rel_exp = unique_ptr<BaseAST>($3);
+    ast->rel_exp = $3;
     $$ = ast;
   }
   ;
 
 LAndExp
   : EqExp {
-    auto ast = new LAndExpAST_0();
-    ast->eq_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<LAndExpAST_0>();
+    ast->eq_exp = $1;
     $$ = ast;
   }
   | LAndExp AND EqExp {
-    auto ast = new LAndExpAST_1();
-    ast->land_exp = unique_ptr<BaseAST>($1);
-    ast->eq_exp = unique_ptr<BaseAST>($3);
+    auto ast = arena.make<LAndExpAST_1>();
+    ast->land_exp = $1;
+    ast->eq_exp = $3;
     $$ = ast;
   }
   ;
 
 LOrExp
   : LAndExp {
-    auto ast = new LOrExpAST_0();
-    ast->land_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<LOrExpAST_0>();
+    ast->land_exp = $1;
     $$ = ast;
   }
   | LOrExp OR LAndExp {
-    auto ast = new LOrExpAST_1();
-    ast->lor_exp = unique_ptr<BaseAST>($1);
-    ast->land_exp = unique_ptr<BaseAST>($3);
+    auto ast = arena.make<LOrExpAST_1>();
+    ast->lor_exp = $1;
+    ast->land_exp = $3;
     $$ = ast;
   }
   ;
 
 Decl
   : ConstDecl {
-    auto ast = new DeclAST_0();
-    ast->const_decl = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<DeclAST_0>();
+    ast->const_decl = $1;
     $$ = ast;
   }
   | VarDecl {
-    auto ast = new DeclAST_1();
-    ast->var_decl = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<DeclAST_1>();
+    ast->var_decl = $1;
     $$ = ast;
   }
   ;
 
 ConstDecl
   : CONST BType ConstDefs ';' {
-    auto ast = new ConstDeclAST();
-    ast->btype = unique_ptr<BaseAST>($2);
-    ast->const_defs = unique_ptr<BaseAST>($3);
+    auto ast = arena.make<ConstDeclAST>();
+    ast->btype = $2;
+    ast->const_defs = $3;
     $$ = ast;
   }
   ;
 
 ConstDefs
   : ConstDef {
-    auto ast = new ConstDefsAST();
-    ast->const_defs = nullptr;
-    ast->const_def = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<ConstDefsAST>();
+    ast->const_defs.push_back(arena, $1);
     $$ = ast;
   }
   | ConstDefs ',' ConstDef {
-    auto ast = new ConstDefsAST();
-    ast->const_defs = unique_ptr<BaseAST>($1);
-    ast->const_def = unique_ptr<BaseAST>($3);
+    auto ast = static_cast<ConstDefsAST *>($1);
+    ast->const_defs.push_back(arena, $3);
     $$ = ast;
   }
   ;
 
 BType
   : INT {
-    auto ast = new BTypeAST();
+    auto ast = arena.make<BTypeAST>();
     ast->btype = "int";
     $$ = ast;
   }
@@ -361,86 +369,84 @@ BType
 
 ConstDef
   : IDENT '=' ConstInitVal {
-    auto ast = new ConstDefAST();
-    ast->ident = *$1;
-    ast->const_init_val = unique_ptr<BaseAST>($3);
+    auto ast = arena.make<ConstDefAST>();
+    ast->ident = $1;
+    ast->const_init_val = $3;
     $$ = ast;
   }
   ;
 
 ConstInitVal
   : ConstExp {
-    auto ast = new ConstInitValAST();
-    ast->const_exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<ConstInitValAST>();
+    ast->const_exp = $1;
     $$ = ast;
   }
   ;
 
 LVal
   : IDENT {
-    auto ast = new LValAST();
-    ast->ident = *$1;
+    auto ast = arena.make<LValAST>();
+    ast->ident = $1;
     $$ = ast;
   }
   ;
 
 ConstExp
   : Exp {
-    auto ast = new ConstExpAST();
-    ast->exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<ConstExpAST>();
+    ast->exp = $1;
     $$ = ast;
   }
   ;
 
 VarDecl
   : BType VarDefs ';' {
-    auto ast = new VarDeclAST();
-    ast->btype = unique_ptr<BaseAST>($1);
-    ast->var_defs = unique_ptr<BaseAST>($2);
+    auto ast = arena.make<VarDeclAST>();
+    ast->btype = $1;
+    ast->var_defs = $2;
     $$ = ast;
   }
   ;
 
 VarDefs
   : VarDef {
-    auto ast = new VarDefsAST();
-    ast->var_defs = nullptr;
-    ast->var_def = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<VarDefsAST>();
+    ast->var_defs.push_back(arena, $1);
     $$ = ast;
   }
   | VarDefs ',' VarDef {
-    auto ast = new VarDefsAST();
-    ast->var_defs = unique_ptr<BaseAST>($1);
-    ast->var_def = unique_ptr<BaseAST>($3);
+    auto ast = static_cast<VarDefsAST *>($1);
+    ast->var_defs.push_back(arena, $3);
     $$ = ast;
   }
   ;
 
 VarDef
   : IDENT {
-    auto ast = new VarDefAST();
-    ast->ident = *$1;
+    auto ast = arena.make<VarDefAST>();
+    ast->ident = $1;
     ast->init_val = nullptr;
     $$ = ast;
   }
   | IDENT '=' InitVal {
-    auto ast = new VarDefAST();
-    ast->ident = *$1;
-    ast->init_val = unique_ptr<BaseAST>($3);
+    auto ast = arena.make<VarDefAST>();
+    ast->ident = $1;
+    ast->init_val = $3;
     $$ = ast;
   }
   ;
 
 InitVal
   : Exp {
-    auto ast = new InitValAST();
-    ast->exp = unique_ptr<BaseAST>($1);
+    auto ast = arena.make<InitValAST>();
+    ast->exp = $1;
     $$ = ast;
   }
   ;
 
 %%
 
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
+void yyerror(yyscan_t scanner, BaseAST *&ast, Arena &arena, Interner &symbols, const char *s) {
   cerr << "error: " << s << endl;
 }
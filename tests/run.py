@@ -0,0 +1,608 @@
+#!/usr/bin/env python3
+"""Runs the compiler's regression checks.
+
+usage: run.py <compiler> <work dir>
+
+Each check compiles small programs written to the work dir and inspects
+the output. A failing check prints what it expected and the run exits 1.
+llvm-mc and llvm-objcopy must be on PATH.
+"""
+import os
+import random
+import shutil
+import subprocess
+import sys
+
+import rv32
+
+
+def write_input(work, name, source):
+    """Writes source, SysY text or binary IR given as bytes."""
+    binary = isinstance(source, bytes)
+    src = os.path.join(work, name + (".kb" if binary else ".c"))
+    with open(src, "wb" if binary else "w") as f:
+        f.write(source)
+    return src
+
+
+def run_compiler(compiler, work, name, source, mode, flags=()):
+    src = write_input(work, name, source)
+    out = os.path.join(work, name + "".join(flags) + mode.replace("-", "."))
+    subprocess.run([compiler, mode, src, "-o", out] + list(flags), check=True)
+    return out
+
+
+def blocks(koopa):
+    """Splits Koopa text into (function, label, instructions) per block."""
+    result = []
+    func = None
+    for line in koopa.splitlines():
+        line = line.strip()
+        if line.startswith("fun "):
+            func = line.split()[1].split("(")[0]
+        elif line.startswith("%") and line.endswith(":"):
+            result.append((func, line, []))
+        elif result and line and line != "{" and line != "}":
+            result[-1][2].append(line)
+    return result
+
+
+# && and || must not evaluate a right-hand side that can trap, here by
+# dividing by zero, before the left-hand side has been tested.
+SHORT_CIRCUIT = [
+    ("and_div", "int main() {\n  int y = 0;\n  return y && 10 / y;\n}\n"),
+    ("or_mod", "int main() {\n  int y = 0;\n  return y || 10 % y;\n}\n"),
+    ("or_not_mod", "int main() {\n  int y = 0;\n  return !y || 10 % y;\n}\n"),
+]
+
+
+def check_short_circuit(compiler, work):
+    ok = True
+    for name, source in SHORT_CIRCUIT:
+        for flags in [(), ("-O1",)]:
+            with open(run_compiler(compiler, work, name, source, "-koopa", flags)) as f:
+                entry = blocks(f.read())[0]
+            trapping = [i for i in entry[2] if " div " in i or " mod " in i]
+            if trapping:
+                print("%s %s: %s runs in %s before the branch" % (name, " ".join(flags), trapping[0], entry[1]))
+                ok = False
+    return ok
+
+
+# -obj encodes instructions itself; its .text must match what an assembler
+# makes of the -riscv output for the same program.
+OBJ_PROGRAMS = [
+    ("arith", "int main() {\n  int a = 7, b = -3;\n  return (a * b + 100) / 6 % 5 - (a == 7) * !b;\n}\n"),
+    ("logic", "int main() {\n  int x = 2, y = 0;\n  return (x && y) + (x || y) * 2 + (x > y) + (x <= 1) + (y != 0);\n}\n"),
+    ("spill", "int main() {\n  int x = 2;\n  return %s;\n}\n" % ("x * 0" + "".join(" + (x * %d" % i for i in range(1, 24)) + ")" * 23)),
+    # li immediates whose upper part rounds up past 0x7ffff
+    ("imms", "int main() {\n  int a = 2147483647, b = 2147481600, c = -2147483647 - 1;\n  return a - b + c / 65536;\n}\n"),
+]
+
+
+def text_bytes(obj):
+    out = obj + ".text"
+    subprocess.run(["llvm-objcopy", "-O", "binary", "--only-section=.text", obj, out], check=True)
+    with open(out, "rb") as f:
+        return f.read()
+
+
+def obj_matches_asm(compiler, work, name, source, flags):
+    asm = run_compiler(compiler, work, name, source, "-riscv", flags)
+    assembled = asm + ".o"
+    subprocess.run(["llvm-mc", "-triple=riscv32", "-mattr=+m,-relax", "-filetype=obj",
+                    asm, "-o", assembled], check=True)
+    obj = run_compiler(compiler, work, name, source, "-obj", flags)
+    if text_bytes(obj) != text_bytes(assembled):
+        print("%s %s: .text of %s differs from %s assembled" % (name, " ".join(flags), obj, asm))
+        return False
+    return True
+
+
+def check_obj_matches_asm(compiler, work):
+    ok = True
+    for name, source in OBJ_PROGRAMS:
+        for flags in [(), ("-O1",)]:
+            ok &= obj_matches_asm(compiler, work, name, source, flags)
+    return ok
+
+
+# Binary IR as written by -koopa-bin; see src/koopa_bin.h for the layout.
+KOOPA_BIN_MAGIC = b"KPB1"
+BIN_BINARY, BIN_BRANCH, BIN_RET = 3, 4, 6
+RBO_GT, RBO_LT, RBO_ADD, RBO_SUB, RBO_MUL, RBO_DIV, RBO_MOD, RBO_XOR = 2, 3, 6, 7, 8, 9, 10, 13
+
+
+def varint(x):
+    out = bytearray()
+    while x >= 0x80:
+        out.append(x & 0x7f | 0x80)
+        x >>= 7
+    out.append(x)
+    return bytes(out)
+
+
+def value(number):
+    return varint((number + 1) << 1)
+
+
+def const(x):
+    zigzag = ((x << 1) ^ (x >> 31)) & 0xffffffff
+    return varint(zigzag << 1 | 1)
+
+
+def binary(op, lhs, rhs):
+    return bytes([BIN_BINARY, op]) + lhs + rhs
+
+
+def branch(cond, true_bb, false_bb):
+    return bytes([BIN_BRANCH]) + cond + varint(true_bb) + varint(0) + varint(false_bb) + varint(0)
+
+
+def ret(operand=varint(0)):
+    return bytes([BIN_RET]) + operand
+
+
+class KoopaBin:
+    def __init__(self):
+        self.strings = []
+        self.sections = []
+
+    def string(self, s):
+        if s not in self.strings:
+            self.strings.append(s)
+        return varint(self.strings.index(s))
+
+    def function(self, name, blocks):
+        """Adds a function of (name, params, [instruction]) blocks."""
+        section = self.string(name) + varint(len(blocks))
+        for bb_name, params, insts in blocks:
+            section += self.string(bb_name) + varint(params) + varint(len(insts)) + b"".join(insts)
+        self.sections.append(section)
+
+    def bytes(self):
+        out = KOOPA_BIN_MAGIC + varint(len(self.strings))
+        for s in self.strings:
+            out += varint(len(s)) + s.encode()
+        out += varint(len(self.sections))
+        for section in self.sections:
+            out += varint(len(section)) + section
+        return out
+
+
+def many_functions(count):
+    """A program of count functions of varied size, which the grammar
+    cannot express: each computes a chain of values and returns one."""
+    rand = random.Random(count)
+    kb = KoopaBin()
+    for i in range(count):
+        insts = []
+        for n in range(rand.randrange(4, 60)):
+            op = rand.choice([RBO_ADD, RBO_SUB, RBO_MUL, RBO_DIV, RBO_MOD, RBO_LT, RBO_XOR])
+            lhs = value(rand.randrange(n)) if n else const(rand.randrange(-99, 99))
+            rhs = const(rand.choice([3, 7, 97, -8])) if op in (RBO_DIV, RBO_MOD) else value(rand.randrange(n)) if n else const(5)
+            insts.append(binary(op, lhs, rhs))
+        n = len(insts)
+        insts.append(branch(value(n - 1), 1, 2))
+        kb.function("@f%d" % i, [("%%f%d_entry" % i, 0, insts),
+                                 ("%%f%d_then" % i, 0, [ret(value(rand.randrange(n)))]),
+                                 ("%%f%d_else" % i, 0, [ret(const(i))])])
+    return kb.bytes()
+
+
+def check_parallel_codegen(compiler, work):
+    """Functions generated by several workers join into the same output
+    as generated by one."""
+    ok = True
+    source = many_functions(40)
+    for mode in ["-riscv", "-obj"]:
+        for level in [(), ("-O1",)]:
+            outputs = []
+            for workers in ["1", "4"]:
+                out = run_compiler(compiler, work, "many", source, mode, level + ("-j", workers))
+                with open(out, "rb") as f:
+                    outputs.append(f.read())
+            if outputs[0] != outputs[1]:
+                print("many %s %s: -j 4 output differs from -j 1" % (mode, " ".join(level)))
+                ok = False
+    return ok
+
+
+def rejects(compiler, work, name, source):
+    """Whether both backends refuse the input with an error rather than
+    a crash."""
+    src = write_input(work, name, source)
+    for mode in ["-koopa", "-riscv"]:
+        result = subprocess.run([compiler, mode, src, "-o", os.devnull], capture_output=True, text=True)
+        if result.returncode != 1 or "malformed binary IR" not in result.stderr:
+            print("%s %s: exit %d, %s" % (name, mode, result.returncode, result.stderr.strip() or "no error"))
+            return False
+    return True
+
+
+def check_bin_rejects_malformed(compiler, work):
+    ok = True
+    kb = KoopaBin()
+    kb.function("@main", [("%entry", 0, [ret()])])
+    ok &= rejects(compiler, work, "ret_none", kb.bytes())
+
+    # every proper prefix of a valid file, with allocs and with block
+    # arguments
+    for flags in [(), ("-O1",)]:
+        out = run_compiler(compiler, work, "valid", SHORT_CIRCUIT[0][1], "-koopa-bin", flags)
+        with open(out, "rb") as f:
+            valid = f.read()
+        for size in range(len(KOOPA_BIN_MAGIC), len(valid)):
+            if not rejects(compiler, work, "truncated", valid[:size]):
+                ok = False
+                break
+    return ok
+
+
+# Unused divisions by zero still trap, so dead code elimination keeps them;
+# an unused division by a constant it may drop.
+UNUSED_DIVISIONS = ("int main() {\n  int y = 0, x = 5;\n  int a = x / y, b = x % 7, c = 10 % y;\n"
+                    "  return 1;\n}\n")
+
+
+def check_dce_keeps_traps(compiler, work):
+    ok = True
+    for flags in [("-dce",), ("-O1",)]:
+        with open(run_compiler(compiler, work, "unused_div", UNUSED_DIVISIONS, "-koopa", flags)) as f:
+            insts = [i for _, _, insts in blocks(f.read()) for i in insts]
+        divisions = [i for i in insts if " div " in i or " mod " in i]
+        if len(divisions) != 2:
+            print("unused_div %s: expected the two divisions by y, got %s" % (" ".join(flags), divisions))
+            ok = False
+    return ok
+
+
+INT_MIN, INT_MAX = -2 ** 31, 2 ** 31 - 1
+
+
+def literal(x):
+    return "(-2147483647 - 1)" if x == INT_MIN else "(%d)" % x
+
+
+def run_program(compiler, work, name, source, flags=()):
+    """Compiles source to an object and returns what main returns."""
+    return rv32.run_object(run_compiler(compiler, work, name, source, "-obj", flags))[0]
+
+
+def returns(compiler, work, cases, flags):
+    """Runs each (name, expression over x, x, expected) case as the return
+    value of a program, and prints the ones whose result is wrong."""
+    ok = True
+    for name, expr, x, expected in cases:
+        source = "int main() {\n  int x = %s;\n  return %s;\n}\n" % (literal(x), expr)
+        got = run_program(compiler, work, name, source, flags)
+        if got != expected:
+            print("%s %s: x = %d, %s gave %d, expected %d" % (name, " ".join(flags), x, expr, got, expected))
+            ok = False
+    return ok
+
+
+def wrap(x):
+    return (x + 2 ** 31) % 2 ** 32 - 2 ** 31
+
+
+def c_div(x, d):
+    # RV32 div wraps INT_MIN / -1 to INT_MIN, with remainder 0
+    q = wrap(abs(x) // abs(d) * (1 if (x < 0) == (d < 0) else -1))
+    return q, wrap(x - q * d)
+
+
+DIVIDENDS = [INT_MIN, INT_MAX, -1, 0, 1, -100, 100]
+DIVISORS = [1, -1, 2, -2, 8, -8, 4096, -4096, 2 ** 30, -2 ** 30, INT_MIN, 3, 7, 97, -7]
+COMPARED = [INT_MIN, -2049, -2048, -1, 0, 1, 2047, 2048, INT_MAX]
+
+
+def check_constant_division(compiler, work):
+    """Division by a constant, lowered to shifts for powers of two and to
+    a multiply-high sequence otherwise, and compares against constants,
+    lowered to slti and xori, agree with exact arithmetic. At -O1 the
+    dividend is known and the same expressions are folded instead."""
+    cases = []
+    for x in DIVIDENDS:
+        for d in DIVISORS:
+            q, r = c_div(x, d)
+            cases.append(("div", "x / %s" % literal(d), x, q))
+            cases.append(("mod", "x %% %s" % literal(d), x, r))
+        for c in COMPARED:
+            c_lit = literal(c)
+            expr = " + ".join("(x %s %s) * %d" % (op, c_lit, 1 << i)
+                              for i, op in enumerate(["<", ">", "<=", ">=", "==", "!="]))
+            expected = sum(int(v) << i for i, v in enumerate([x < c, x > c, x <= c, x >= c, x == c, x != c]))
+            cases.append(("compare", expr, x, expected))
+    return returns(compiler, work, cases, ()) & returns(compiler, work, cases, ("-O1",))
+
+
+# Programs run under each pass on its own and under -O1, with the value
+# main must return.
+PASS_FLAGS = [(), ("-mem2reg",), ("-lvn",), ("-dce",), ("-O1",)]
+PASS_PROGRAMS = [
+    ("reassign", "int main() {\n  int a = 1, b = 2;\n  a = a + b;\n  b = a * b;\n  a = a - b * 2;\n"
+                 "  return a * 10 + b;\n}\n", -84),
+    ("repeat", "int main() {\n  int x = 4, y = 5;\n  int p = x + y, q = x + y;\n  x = 1;\n  int r = x + y;\n"
+               "  return p * 100 + q * 10 + r;\n}\n", 996),
+    ("logic", "int main() {\n  int x = 0, y = 3;\n  int a = x && y / x;\n  int b = y || x;\n"
+              "  int c = !x && (y > 2 || x);\n  return a + b * 2 + c * 4;\n}\n", 6),
+    ("dead", "int main() {\n  int x = 1;\n  int unused = x * 99;\n  x = 2;\n  return x + 3;\n"
+             "  x = 7;\n  return x;\n}\n", 5),
+    ("consts", "int main() {\n  const int N = 10, M = N * N;\n  int s = M - N;\n  s = s / 3 + s % 7;\n"
+               "  return s;\n}\n", 36),
+]
+
+
+def check_passes_agree(compiler, work):
+    ok = True
+    for name, source, expected in PASS_PROGRAMS:
+        for flags in PASS_FLAGS:
+            got = run_program(compiler, work, name, source, flags)
+            if got != expected:
+                print("%s %s: returned %d, expected %d" % (name, " ".join(flags), got, expected))
+                ok = False
+    return ok
+
+
+def koopa_insts(compiler, work, name, source, flags):
+    with open(run_compiler(compiler, work, name, source, "-koopa", flags)) as f:
+        return [i for _, _, insts in blocks(f.read()) for i in insts]
+
+
+def check_mem2reg_promotes(compiler, work):
+    """No local variable is left in memory after mem2reg."""
+    ok = True
+    for name, source, _ in PASS_PROGRAMS:
+        for flags in [("-mem2reg",), ("-O1",)]:
+            memory = [i for i in koopa_insts(compiler, work, name, source, flags)
+                      if "alloc " in i or "load " in i or i.startswith("store ")]
+            if memory:
+                print("%s %s: %s left after mem2reg" % (name, " ".join(flags), memory[0]))
+                ok = False
+    return ok
+
+
+def check_lvn_reuses(compiler, work):
+    """The second x + y of the repeat program reuses the first, whether
+    x and y are loads or promoted values."""
+    ok = True
+    source = dict((name, source) for name, source, _ in PASS_PROGRAMS)["repeat"]
+    for before, after in [((), ("-lvn",)), (("-mem2reg",), ("-mem2reg", "-lvn"))]:
+        adds = [sum(" add " in i for i in koopa_insts(compiler, work, "repeat", source, flags))
+                for flags in (before, after)]
+        if adds[1] != adds[0] - 1:
+            print("repeat %s: %d adds, %d without lvn" % (" ".join(after), adds[1], adds[0]))
+            ok = False
+    return ok
+
+
+def many_live(count):
+    """A program that keeps count values live at once, and what it
+    returns."""
+    lines = ["int main() {", "  int x = 3;"]
+    lines += ["  int v%d = x * %d + %d;" % (i, i, i % 7) for i in range(count)]
+    lines += ["  return %s;" % " + ".join("v%d" % i for i in range(count)), "}", ""]
+    return "\n".join(lines), sum(3 * i + i % 7 for i in range(count))
+
+
+def memory_insts(asm):
+    return [line for line in asm.splitlines() if line.startswith(("lw ", "sw "))]
+
+
+def check_regalloc(compiler, work):
+    """-O1 keeps the values of small programs in registers, and spills
+    correctly once more values are live than there are registers. rv32
+    checks that the callee-saved registers it uses are restored."""
+    ok = True
+    for name, source, _ in PASS_PROGRAMS:
+        with open(run_compiler(compiler, work, name, source, "-riscv", ("-O1",))) as f:
+            memory = memory_insts(f.read())
+        if memory:
+            print("%s -O1: %s with registers to spare" % (name, memory[0]))
+            ok = False
+
+    source, expected = many_live(40)
+    with open(run_compiler(compiler, work, "many_live", source, "-riscv", ("-O1",))) as f:
+        spills = [i for i in memory_insts(f.read()) if not i.split()[1].startswith("s")]
+    if not spills:
+        print("many_live -O1: 40 live values and no spill")
+        ok = False
+    for flags in [(), ("-O1",)]:
+        got = run_program(compiler, work, "many_live", source, flags)
+        if got != expected:
+            print("many_live %s: returned %d, expected %d" % (" ".join(flags), got, expected))
+            ok = False
+    return ok
+
+
+def leftovers(asm):
+    """Instructions the peephole pass should have removed: moves and adds
+    that change nothing, and jumps to the next instruction."""
+    lines = [line.strip() for line in asm.splitlines()]
+    found = []
+    for i, line in enumerate(lines):
+        op, _, args = line.partition(" ")
+        args = args.split(", ")
+        if op == "mv" and args[0] == args[1] or op == "addi" and args[0] == args[1] and args[2] == "0":
+            found.append(line)
+        elif op == "j" and i + 1 < len(lines) and lines[i + 1] == args[0] + ":":
+            found.append(line + " before " + lines[i + 1])
+    return found
+
+
+def check_peephole(compiler, work):
+    """At -O1 the peephole rules fire on branchy and spilling code, and
+    leave none of the patterns they remove. passes_agree and regalloc run
+    the same code."""
+    ok = True
+    programs = [(name, source) for name, source, _ in PASS_PROGRAMS] + [("many_live", many_live(40)[0])]
+    removed = 0
+    for name, source in programs:
+        src = write_input(work, name, source)
+        out = os.path.join(work, name + "-O1.peephole.s")
+        result = subprocess.run([compiler, "-riscv", src, "-o", out, "-O1", "--stats"],
+                                check=True, capture_output=True, text=True)
+        for line in result.stderr.splitlines():
+            if line.startswith("peephole: total"):
+                removed += int(line.split()[-1])
+        with open(out) as f:
+            found = leftovers(f.read())
+        if found:
+            print("%s -O1: %s left after peephole" % (name, found[0]))
+            ok = False
+    if removed == 0:
+        print("peephole removed nothing from any program")
+        ok = False
+    return ok
+
+
+def frame_bytes(asm):
+    """The stack frame main allocates, from its first instructions."""
+    lines = [line.strip() for line in asm.splitlines()]
+    first = lines[lines.index("main:") + 1:]
+    if first[0].startswith("addi sp, sp, "):
+        return -int(first[0].split()[-1])
+    if first[0].startswith("li ") and first[1] == "add sp, sp, " + first[0].split()[1].rstrip(","):
+        return -int(first[0].split()[-1])
+    return 0
+
+
+def check_frames(compiler, work):
+    """Values whose live ranges do not overlap share a stack slot, so a
+    long chain of temporaries needs a small frame. 600 values live at
+    once still need a frame past the 12-bit offsets of lw and sw, which
+    must be addressed correctly under every pass."""
+    ok = True
+    lines = ["int main() {", "  int x = 1;"] + ["  x = x * 3 + %d;" % (i % 5) for i in range(600)]
+    chain = "\n".join(lines + ["  return x;", "}", ""])
+    x = 1
+    for i in range(600):
+        x = wrap(x * 3 + i % 5)
+    with open(run_compiler(compiler, work, "chain", chain, "-riscv")) as f:
+        size = frame_bytes(f.read())
+    if size > 64:
+        print("chain: %d byte frame for temporaries that die at once" % size)
+        ok = False
+
+    wide, expected = many_live(600)
+    for name, source, result in [("chain", chain, x), ("wide", wide, expected)]:
+        for flags in PASS_FLAGS:
+            got = run_program(compiler, work, name, source, flags)
+            if got != result:
+                print("%s %s: returned %d, expected %d" % (name, " ".join(flags), got, result))
+                ok = False
+    for flags in [(), ("-O1",)]:
+        with open(run_compiler(compiler, work, "wide", wide, "-riscv", flags)) as f:
+            size = frame_bytes(f.read())
+        if size < 2048:
+            print("wide %s: %d byte frame, expected one past 2047" % (" ".join(flags), size))
+            ok = False
+        ok &= obj_matches_asm(compiler, work, "wide", wide, flags)
+    return ok
+
+
+def read_bytes(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def counters(stderr):
+    """The counters --stats prints, by name."""
+    result = {}
+    for line in stderr.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[-1].isdigit():
+            result[" ".join(fields[:-1])] = int(fields[-1])
+    return result
+
+
+def check_cache(compiler, work):
+    """A hit serves the bytes a plain compile writes, another flag set
+    misses, and a size cap of 0 evicts everything stored."""
+    ok = True
+    cache = os.path.join(work, "cache")
+    shutil.rmtree(cache, ignore_errors=True)
+    programs = dict((name, source) for name, source, _ in PASS_PROGRAMS)
+
+    def cached(name, mode, flags, expect):
+        src = write_input(work, name, programs[name])
+        out = os.path.join(work, name + "".join(flags) + mode.replace("-", ".") + ".cached")
+        result = subprocess.run([compiler, mode, src, "-o", out, "--cache", cache, "--stats"] + list(flags),
+                                check=True, capture_output=True, text=True)
+        got = "hit" if counters(result.stderr).get("cache hits") else "miss"
+        plain = read_bytes(run_compiler(compiler, work, name, programs[name], mode, flags))
+        if got != expect or read_bytes(out) != plain:
+            print("cache %s %s %s: %s, expected %s%s" % (name, mode, " ".join(flags), got, expect,
+                                                       "" if read_bytes(out) == plain else ", output differs"))
+            return False
+        return True
+
+    for mode in ["-riscv", "-obj"]:
+        ok &= cached("reassign", mode, (), "miss")
+        ok &= cached("reassign", mode, (), "hit")
+        ok &= cached("reassign", mode, ("-O1",), "miss")
+        ok &= cached("reassign", mode, ("-O1",), "hit")
+
+    ok &= cached("repeat", "-riscv", ("--cache-size", "0"), "miss")
+    entries = [e for e in os.listdir(cache) if not e.startswith(".")]
+    if entries:
+        print("cache: %d entries left under --cache-size 0" % len(entries))
+        ok = False
+    ok &= cached("reassign", "-riscv", (), "miss")
+    return ok
+
+
+def check_batch(compiler, work):
+    """A manifest compiled on several workers gives each file the output
+    of a single-file run, and a file that does not parse fails the batch
+    without stopping the others."""
+    ok = True
+    programs = [(name, source) for name, source, _ in PASS_PROGRAMS]
+    programs.insert(2, ("broken", "int main() {\n  return 1 +;\n}\n"))
+    for mode, flags in [("-riscv", ()), ("-obj", ("-O1",))]:
+        manifest = os.path.join(work, "manifest")
+        with open(manifest, "w") as f:
+            for name, source in programs:
+                src = write_input(work, name, source)
+                out = os.path.join(work, name + ".batch")
+                if os.path.exists(out):
+                    os.remove(out)
+                f.write("%s %s\n" % (src, out))
+        result = subprocess.run([compiler, mode, "--batch", manifest, "-j", "3"] + list(flags),
+                                capture_output=True, text=True)
+        if result.returncode == 0 or "1 failed" not in result.stderr:
+            print("batch %s: exit %d, expected one failure: %s" % (mode, result.returncode, result.stderr.strip()))
+            ok = False
+        for name, source in programs:
+            if name == "broken":
+                continue
+            single = read_bytes(run_compiler(compiler, work, name, source, mode, flags))
+            batch = os.path.join(work, name + ".batch")
+            if not os.path.exists(batch) or read_bytes(batch) != single:
+                print("batch %s %s: output differs from a single-file run" % (mode, name))
+                ok = False
+    return ok
+
+
+CHECKS = [check_short_circuit, check_obj_matches_asm, check_parallel_codegen, check_bin_rejects_malformed,
+          check_dce_keeps_traps, check_constant_division, check_passes_agree, check_mem2reg_promotes,
+          check_lvn_reuses, check_regalloc, check_peephole, check_frames, check_cache, check_batch]
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    compiler, work = sys.argv[1], sys.argv[2]
+    os.makedirs(work, exist_ok=True)
+
+    failed = False
+    for check in CHECKS:
+        ok = check(compiler, work)
+        print("%-24s %s" % (check.__name__[len("check_"):], "ok" if ok else "FAILED"))
+        failed |= not ok
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
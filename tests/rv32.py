@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Runs a function of an RV32IM object written by -obj.
+
+usage: rv32.py <object> [function]
+
+Interprets the machine code in .text, so the result shows what the
+encoded instructions compute. The function is called with a fresh stack,
+and its return value is printed. It must leave sp and the callee-saved
+registers as it found them.
+"""
+import struct
+import sys
+
+STACK_TOP = 0x7ff00000
+RETURN_ADDRESS = 0xfffffff0
+MAX_STEPS = 10000000
+CALLEE_SAVED = [8, 9] + list(range(18, 28))  # s0-s11
+
+
+def sext(x, bits):
+    x &= (1 << bits) - 1
+    return x - (1 << bits) if x >> (bits - 1) else x
+
+
+def load(path):
+    """Returns the .text bytes and the offset of each function symbol."""
+    with open(path, "rb") as f:
+        image = f.read()
+    shoff, = struct.unpack_from("<I", image, 32)
+    shnum, shstrndx = struct.unpack_from("<HH", image, 48)
+    sections = [struct.unpack_from("<IIIIIIIIII", image, shoff + i * 40) for i in range(shnum)]
+
+    def name(table, offset):
+        start = sections[table][4] + offset
+        return image[start:image.index(b"\0", start)].decode()
+
+    text, symbols = b"", {}
+    for sh in sections:
+        sh_name, sh_type, _, _, offset, size, link = sh[:7]
+        if name(shstrndx, sh_name) == ".text":
+            text = image[offset:offset + size]
+        elif sh_type == 2:  # SHT_SYMTAB
+            for i in range(size // 16):
+                st_name, st_value, _, st_info, _, _ = struct.unpack_from("<IIIBBH", image, offset + i * 16)
+                if st_info & 0xf == 2:  # STT_FUNC
+                    symbols[name(link, st_name)] = st_value
+    return text, symbols
+
+
+def run(text, entry):
+    """Calls the code at entry and returns a0 and the instructions run."""
+    x = [0] * 32
+    x[1] = RETURN_ADDRESS
+    x[2] = STACK_TOP
+    for r in CALLEE_SAVED:
+        x[r] = 0x5a5a0000 + r
+    memory = {}
+    pc, steps = entry, 0
+    while pc != RETURN_ADDRESS:
+        steps += 1
+        if steps > MAX_STEPS or pc % 4 or not 0 <= pc < len(text):
+            raise RuntimeError("bad pc %#x after %d instructions" % (pc, steps))
+        w, = struct.unpack_from("<I", text, pc)
+        opcode, rd, funct3 = w & 0x7f, w >> 7 & 31, w >> 12 & 7
+        a, b, funct7 = x[w >> 15 & 31], x[w >> 20 & 31], w >> 25
+        imm_i = sext(w >> 20, 12)
+        next_pc = pc + 4
+        result = None
+        if opcode == 0x37:  # lui
+            result = sext(w & 0xfffff000, 32)
+        elif opcode == 0x17:  # auipc
+            result = pc + sext(w & 0xfffff000, 32)
+        elif opcode == 0x6f:  # jal
+            result = next_pc
+            next_pc = pc + sext((w >> 31) << 20 | (w >> 12 & 0xff) << 12 | (w >> 20 & 1) << 11 |
+                                (w >> 21 & 0x3ff) << 1, 21)
+        elif opcode == 0x67:  # jalr
+            result = next_pc
+            next_pc = (a + imm_i) & 0xfffffffe
+        elif opcode == 0x63:
+            ua, ub = a & 0xffffffff, b & 0xffffffff
+            taken = [a == b, a != b, None, None, a < b, a >= b, ua < ub, ua >= ub][funct3]
+            if taken is None:
+                raise RuntimeError("bad branch %#010x at %#x" % (w, pc))
+            if taken:
+                next_pc = pc + sext((w >> 31) << 12 | (w >> 7 & 1) << 11 | (w >> 25 & 0x3f) << 5 |
+                                    (w >> 8 & 0xf) << 1, 13)
+        elif opcode == 0x03 and funct3 == 2:  # lw
+            result = memory.get(sext(a + imm_i, 32), 0)
+        elif opcode == 0x23 and funct3 == 2:  # sw
+            memory[sext(a + sext(funct7 << 5 | rd, 12), 32)] = b
+            rd = 0
+        elif opcode in (0x13, 0x33):
+            if opcode == 0x13:
+                b = imm_i
+                if funct3 != 5:
+                    funct7 = 0
+            result = alu(funct3, funct7, a, b)
+            if result is None:
+                raise RuntimeError("bad instruction %#010x at %#x" % (w, pc))
+        else:
+            raise RuntimeError("bad instruction %#010x at %#x" % (w, pc))
+        if result is not None and rd:
+            x[rd] = sext(result, 32)
+        pc = next_pc & 0xffffffff
+    if x[2] != STACK_TOP:
+        raise RuntimeError("sp not restored")
+    for r in CALLEE_SAVED:
+        if x[r] != 0x5a5a0000 + r:
+            raise RuntimeError("s%d not restored" % CALLEE_SAVED.index(r))
+    return x[10], steps
+
+
+def truncate_div(a, b):
+    q = abs(a) // abs(b)
+    return q if (a < 0) == (b < 0) else -q
+
+
+def alu(funct3, funct7, a, b):
+    ua, ub, shamt = a & 0xffffffff, b & 0xffffffff, b & 31
+    if funct7 == 0:
+        return [a + b, a << shamt, int(a < b), int(ua < ub), a ^ b, ua >> shamt, a | b, a & b][funct3]
+    if funct7 == 0x20:
+        return {0: a - b, 5: a >> shamt}.get(funct3)
+    if funct7 == 1:
+        if funct3 == 0:
+            return a * b
+        if funct3 in (1, 2, 3):
+            return [None, a * b, a * ub, ua * ub][funct3] >> 32
+        # a quotient of 2^31 wraps to INT_MIN when the result is stored
+        if funct3 == 4:
+            return -1 if b == 0 else truncate_div(a, b)
+        if funct3 == 5:
+            return -1 if ub == 0 else ua // ub
+        if funct3 == 6:
+            return a if b == 0 else a - truncate_div(a, b) * b
+        return ua if ub == 0 else ua % ub
+    return None
+
+
+def run_object(path, function="main"):
+    text, symbols = load(path)
+    return run(text, symbols[function])
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    value, steps = run_object(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else "main")
+    print(value)
+
+
+if __name__ == "__main__":
+    main()